@@ -0,0 +1,98 @@
+#include "batch-amc.h"
+#include "ns3/abort.h"
+#include "ns3/double.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace ns3 {
+
+BatchAmc::BatchAmc (Ptr<LteAmc> amc, uint32_t maxRbs)
+  : m_maxRbs (maxRbs)
+{
+  // Same expression as LteAmc::CreateCqiFeedbacks. CQI(SINR) is monotone, so
+  // bisecting over the ordered bit patterns of the positive doubles finds
+  // each step exactly.
+  DoubleValue ber;
+  amc->GetAttribute ("Ber", ber);
+  double gap = (-std::log (5.0 * ber.Get ())) / 1.5;
+  m_cqiThreshold[0] = 0;
+  for (int cqi = 1; cqi < 16; ++cqi)
+    {
+      int64_t below = 0;
+      double top = std::numeric_limits<double>::max ();
+      int64_t reached;
+      std::memcpy (&reached, &top, sizeof (reached));
+      while (reached - below > 1)
+        {
+          int64_t middle = below + (reached - below) / 2;
+          double sinr;
+          std::memcpy (&sinr, &middle, sizeof (sinr));
+          if (amc->GetCqiFromSpectralEfficiency (log2 (1 + (sinr / gap))) >= cqi)
+            {
+              reached = middle;
+            }
+          else
+            {
+              below = middle;
+            }
+        }
+      std::memcpy (&m_cqiThreshold[cqi], &reached, sizeof (double));
+    }
+
+  for (int cqi = 0; cqi < 16; ++cqi)
+    {
+      m_mcsOfCqi[cqi] = amc->GetMcsFromCqi (cqi);
+    }
+  m_tbs.resize (29 * maxRbs);
+  for (int mcs = 0; mcs < 29; ++mcs)
+    {
+      for (uint32_t rbs = 1; rbs <= maxRbs; ++rbs)
+        {
+          m_tbs[mcs * maxRbs + rbs - 1] = amc->GetDlTbSizeFromMcs (mcs, rbs);
+        }
+    }
+}
+
+double
+BatchAmc::GetCqiThreshold (uint32_t cqi) const
+{
+  return m_cqiThreshold[cqi];
+}
+
+void
+BatchAmc::Evaluate (uint32_t ues, uint32_t rbs, const double *sinr, int8_t *cqi,
+                    uint8_t *wbCqi, uint8_t *mcs, uint32_t *tbs)
+{
+  NS_ABORT_MSG_UNLESS (rbs >= 1 && rbs <= m_maxRbs, "BatchAmc: " << rbs << " RBs, tables for " << m_maxRbs);
+  m_cqiSum.assign (ues, 0);
+  m_rbsWithSignal.assign (ues, 0);
+  int32_t *sum = m_cqiSum.data ();
+  int32_t *active = m_rbsWithSignal.data ();
+  for (uint32_t rb = 0; rb < rbs; ++rb)
+    {
+      const double *in = sinr + size_t (rb) * ues;
+      int8_t *out = cqi + size_t (rb) * ues;
+      for (uint32_t u = 0; u < ues; ++u)
+        {
+          double x = in[u];
+          int32_t c = 0;
+          for (int k = 1; k < 16; ++k)
+            {
+              c += x >= m_cqiThreshold[k];
+            }
+          int32_t signal = x != 0;
+          out[u] = signal ? c : -1;    // no signal in this RB
+          sum[u] += signal ? c : 0;
+          active[u] += signal;
+        }
+    }
+  for (uint32_t u = 0; u < ues; ++u)
+    {
+      wbCqi[u] = active[u] > 0 ? sum[u] / active[u] : 1;
+      mcs[u] = m_mcsOfCqi[wbCqi[u]];
+      tbs[u] = m_tbs[mcs[u] * m_maxRbs + rbs - 1];
+    }
+}
+
+} // namespace ns3
@@ -0,0 +1,39 @@
+#ifndef BATCH_AMC_H
+#define BATCH_AMC_H
+
+#include "ns3/lte-amc.h"
+#include "ns3/ptr.h"
+#include <stdint.h>
+#include <vector>
+
+namespace ns3 {
+
+/* PiroEW2010 AMC of many UEs at once: per-RB SINR -> CQI, then wideband
+ * CQI (integer mean over the RBs with signal, as LteUePhy reports it) ->
+ * MCS -> TBS with all RBs allocated. Buffers are structure-of-arrays,
+ * [rb * ues + ue], so the inner loops run over consecutive UEs without
+ * calls or branches. Bit-compatible with LteAmc: instead of the spectral
+ * efficiency, each CQI step is a linear SINR threshold, the smallest double
+ * at which LteAmc's log2 (1 + SINR / gap) reaches that CQI; the MCS and TBS
+ * tables are read from the given LteAmc.
+ */
+class BatchAmc
+{
+public:
+  BatchAmc (Ptr<LteAmc> amc, uint32_t maxRbs);
+  void Evaluate (uint32_t ues, uint32_t rbs, const double *sinr, int8_t *cqi,
+                 uint8_t *wbCqi, uint8_t *mcs, uint32_t *tbs);
+  double GetCqiThreshold (uint32_t cqi) const;
+
+private:
+  uint32_t m_maxRbs;
+  double m_cqiThreshold[16];        // [1..15] smallest linear SINR of that CQI
+  uint8_t m_mcsOfCqi[16];
+  std::vector<uint32_t> m_tbs;      // [mcs * maxRbs + rbs - 1], bits
+  std::vector<int32_t> m_cqiSum;    // per UE
+  std::vector<int32_t> m_rbsWithSignal;
+};
+
+} // namespace ns3
+
+#endif /* BATCH_AMC_H */
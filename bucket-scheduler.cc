@@ -0,0 +1,194 @@
+#include "bucket-scheduler.h"
+#include "ns3/assert.h"
+#include "ns3/nstime.h"
+#include <algorithm>
+
+namespace ns3 {
+
+NS_OBJECT_ENSURE_REGISTERED (BucketScheduler);
+
+TypeId
+BucketScheduler::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::BucketScheduler")
+    .SetParent<Scheduler> ()
+    .AddConstructor<BucketScheduler> ()
+  ;
+  return tid;
+}
+
+BucketScheduler::BucketScheduler ()
+  : m_width (MilliSeconds (1).GetTimeStep ()),
+    m_size (0),
+    m_lastTs (0),
+    m_current (0),
+    m_top (0),
+    m_gapSum (0),
+    m_gaps (0),
+    m_dequeues (0)
+{
+  Rebuild (16, m_width);
+}
+
+uint32_t
+BucketScheduler::BucketOf (uint64_t ts) const
+{
+  return (ts / m_width) & (m_buckets.size () - 1);
+}
+
+void
+BucketScheduler::Insert (const Event &ev)
+{
+  Bucket &bucket = m_buckets[BucketOf (ev.key.m_ts)];
+  if (bucket.events.empty () || !(ev.key < bucket.events.back ().key))
+    {
+      bucket.events.push_back (ev);
+    }
+  else
+    {
+      std::vector<Event>::iterator at =
+        std::upper_bound (bucket.events.begin () + bucket.head, bucket.events.end (), ev);
+      bucket.events.insert (at, ev);
+    }
+  if (++m_size > 2 * m_buckets.size ())
+    {
+      Rebuild (2 * m_buckets.size (), TunedWidth ());
+    }
+}
+
+bool
+BucketScheduler::IsEmpty (void) const
+{
+  return m_size == 0;
+}
+
+uint32_t
+BucketScheduler::FindNext (void) const
+{
+  NS_ASSERT (m_size > 0);
+  uint32_t mask = m_buckets.size () - 1;
+  for (uint32_t k = 0; k < m_buckets.size (); ++k)
+    {
+      const Bucket &bucket = m_buckets[m_current];
+      if (bucket.head < bucket.events.size () && bucket.events[bucket.head].key.m_ts < m_top)
+        {
+          return m_current;
+        }
+      m_current = (m_current + 1) & mask;
+      m_top += m_width;
+    }
+
+  // A whole year without an event: jump to the earliest one
+  uint32_t best = m_buckets.size ();
+  for (uint32_t i = 0; i < m_buckets.size (); ++i)
+    {
+      const Bucket &bucket = m_buckets[i];
+      if (bucket.head < bucket.events.size ()
+          && (best == m_buckets.size ()
+              || bucket.events[bucket.head].key < m_buckets[best].events[m_buckets[best].head].key))
+        {
+          best = i;
+        }
+    }
+  m_current = best;
+  m_top = (m_buckets[best].events[m_buckets[best].head].key.m_ts / m_width + 1) * m_width;
+  return best;
+}
+
+Scheduler::Event
+BucketScheduler::PeekNext (void) const
+{
+  const Bucket &bucket = m_buckets[FindNext ()];
+  return bucket.events[bucket.head];
+}
+
+Scheduler::Event
+BucketScheduler::RemoveNext (void)
+{
+  Bucket &bucket = m_buckets[FindNext ()];
+  Event ev = bucket.events[bucket.head++];
+  if (bucket.head == bucket.events.size ())
+    {
+      bucket.events.clear ();
+      bucket.head = 0;
+    }
+  --m_size;
+  if (ev.key.m_ts > m_lastTs)
+    {
+      m_gapSum += ev.key.m_ts - m_lastTs;
+      ++m_gaps;
+      m_lastTs = ev.key.m_ts;
+    }
+
+  if (m_size < m_buckets.size () / 4 && m_buckets.size () > 16)
+    {
+      Rebuild (m_buckets.size () / 2, TunedWidth ());
+    }
+  else if (++m_dequeues % 1024 == 0)
+    {
+      uint64_t width = TunedWidth ();
+      if (width > 2 * m_width || 2 * width < m_width)
+        {
+          Rebuild (m_buckets.size (), width);
+        }
+    }
+  return ev;
+}
+
+void
+BucketScheduler::Remove (const Event &ev)
+{
+  Bucket &bucket = m_buckets[BucketOf (ev.key.m_ts)];
+  std::vector<Event>::iterator at =
+    std::lower_bound (bucket.events.begin () + bucket.head, bucket.events.end (), ev);
+  NS_ASSERT (at != bucket.events.end () && at->key.m_uid == ev.key.m_uid);
+  bucket.events.erase (at);
+  if (bucket.head == bucket.events.size ())
+    {
+      bucket.events.clear ();
+      bucket.head = 0;
+    }
+  --m_size;
+}
+
+uint64_t
+BucketScheduler::TunedWidth (void) const
+{
+  if (m_gaps == 0)
+    {
+      return m_width;
+    }
+  return std::max<uint64_t> (1, 3 * m_gapSum / m_gaps);
+}
+
+void
+BucketScheduler::Rebuild (uint32_t buckets, uint64_t width)
+{
+  std::vector<Bucket> old;
+  old.swap (m_buckets);
+  m_buckets.resize (buckets);
+  for (uint32_t i = 0; i < buckets; ++i)
+    {
+      m_buckets[i].head = 0;
+    }
+  m_width = width;
+  for (uint32_t i = 0; i < old.size (); ++i)
+    {
+      for (uint32_t k = old[i].head; k < old[i].events.size (); ++k)
+        {
+          const Event &ev = old[i].events[k];
+          m_buckets[BucketOf (ev.key.m_ts)].events.push_back (ev);
+        }
+    }
+  for (uint32_t i = 0; i < buckets; ++i)
+    {
+      std::sort (m_buckets[i].events.begin (), m_buckets[i].events.end ());
+    }
+  m_current = BucketOf (m_lastTs);
+  m_top = (m_lastTs / m_width + 1) * m_width;
+  // Gaps seen from here on tune the next rebuild
+  m_gapSum = 0;
+  m_gaps = 0;
+}
+
+} // namespace ns3
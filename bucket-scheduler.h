@@ -0,0 +1,58 @@
+#ifndef BUCKET_SCHEDULER_H
+#define BUCKET_SCHEDULER_H
+
+#include "ns3/scheduler.h"
+#include <stdint.h>
+#include <vector>
+
+namespace ns3 {
+
+/* Calendar queue (Brown 1988) for dense, mostly periodic event streams,
+ * selected as SchedulerType: a power-of-two ring of buckets 'width' time
+ * steps wide, each holding its events sorted by key, so inserting behind the
+ * last event of a bucket (later or same-time events, the common case) and
+ * dequeuing are O(1). The bucket count follows the queue size (doubled at
+ * 2 events per bucket, halved at 1/4). The width starts at one subframe and
+ * follows the mean gap between the distinct timestamps dequeued (x3), so the
+ * events of one subframe share a bucket instead of shrinking it; it is
+ * re-tuned on every resize and, every 1024 dequeues, when it is off by more
+ * than a factor 2.
+ */
+class BucketScheduler : public Scheduler
+{
+public:
+  static TypeId GetTypeId (void);
+  BucketScheduler ();
+
+  virtual void Insert (const Event &ev);
+  virtual bool IsEmpty (void) const;
+  virtual Event PeekNext (void) const;
+  virtual Event RemoveNext (void);
+  virtual void Remove (const Event &ev);
+
+private:
+  struct Bucket
+  {
+    std::vector<Event> events;  // sorted by key from 'head' on
+    uint32_t head;
+  };
+
+  uint32_t BucketOf (uint64_t ts) const;
+  uint32_t FindNext (void) const;
+  uint64_t TunedWidth (void) const;
+  void Rebuild (uint32_t buckets, uint64_t width);
+
+  std::vector<Bucket> m_buckets;
+  uint64_t m_width;              // [time steps]
+  uint32_t m_size;
+  uint64_t m_lastTs;             // of the last dequeued event
+  mutable uint32_t m_current;    // bucket of the next event, as far as known
+  mutable uint64_t m_top;        // end of m_current's window in the current year
+  uint64_t m_gapSum;             // between distinct dequeued timestamps
+  uint64_t m_gaps;
+  uint32_t m_dequeues;
+};
+
+} // namespace ns3
+
+#endif /* BUCKET_SCHEDULER_H */
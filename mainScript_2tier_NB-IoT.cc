@@ -17,10 +17,42 @@
 #include "ns3/lte-ue-net-device.h"
 
 #include "ns3/itu-inh-propagation-loss-model.h" 
+#include "ns3/propagation-loss-model.h"
+#include "ns3/antenna-model.h"
+#include "ns3/ff-mac-scheduler.h"
+#include "ns3/lte-fr-no-op-algorithm.h"
+#include "profiling-simulator-impl.h"
+#include "nbiot-ff-mac-scheduler.h"
+#include "batch-amc.h"
+#include "bucket-scheduler.h"
 #include <iomanip>
+#include <sstream>
 #include <string>
 #include <iostream>
 #include <algorithm>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <vector>
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <thread>
+#include <deque>
+#include <unordered_set>
+#include <unordered_map>
+#include <random>
+#include <ctime>
+#include <chrono>
+#include <cstdio>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <malloc.h>
 
 using namespace ns3;
 /*This file, combined with the ns-3-LBT model available for download at https://www.nsnam.org/~tomh/ns-3-lbt-documents/html/lbt-wifi-coexistence.html allows the simulation of a 2-tier NB-IoT network, and was used in the paper
@@ -29,16 +61,822 @@ Pol Serra i Lidon et al., "Two-tier Architecture for NB-IoT: Improving Coverage
 */
 NS_LOG_COMPONENT_DEFINE ("NB-IoT");
 
-void ThroughputMonitor (FlowMonitorHelper *fmhelper, Ptr<FlowMonitor> flowMon);
+
+/* Cell layout: one entry per macro sector or small cell. Sectors of the same
+ * site share the site number; a beamwidth of 0 means an isotropic antenna.
+ * CSV columns: site,tier,x,y,z,azimuth,beamwidth,maxGain,txPower,ulEarfcn,ulBandwidth[,dlEarfcn]
+ * (without dlEarfcn, the ns-3 default DL EARFCN 100, shared by all cells)
+ */
+struct CellConfig
+{
+  uint32_t site;
+  uint32_t tier;          // 1 = macro (enbNodes1), 2 = small cell (enbNodes2)
+  double x;
+  double y;
+  double z;
+  double azimuth;         // CosineAntennaModel Orientation [deg]
+  double beamwidth;       // [deg], 0 = isotropic
+  double maxGain;         // [dB]
+  double txPower;         // [dBm]
+  uint32_t ulEarfcn;
+  uint32_t ulBandwidth;   // [RB]
+  uint32_t dlEarfcn;
+};
+
+std::vector<CellConfig> DefaultTopology ();
+std::vector<CellConfig> LoadTopology (std::string fileName);
+void SaveTopology (std::string fileName, const std::vector<CellConfig> &cells);
+uint32_t CountCells (const std::vector<CellConfig> &cells, uint32_t tier);
+/* True if a macro cell and a small cell share their DL or their UL EARFCN */
+bool TiersShareCarrier (const std::vector<CellConfig> &cells);
+void InstallCellMobility (const std::vector<CellConfig> &cells, NodeContainer macroNodes, NodeContainer smallNodes);
+void InstallCellDevices (Ptr<LteHelper> lteHelper, const std::vector<CellConfig> &cells,
+                         NodeContainer macroNodes, NodeContainer smallNodes,
+                         NetDeviceContainer &macroDevs, NetDeviceContainer &smallDevs, bool couplingLossCache,
+                         double antennaLutResolution, uint32_t onlyTier = 0);
+
+/* Uniform grid over the (x, y) positions of one tier of cells, built once.
+ * Nearest () returns the cell at the smallest 3D distance, visiting rings of
+ * buckets outwards from the query point until no closer cell can remain.
+ * Ties go to the lowest cell index, as with AttachToClosestEnb.
+ */
+class CellGridIndex
+{
+public:
+  CellGridIndex (NodeContainer cells);
+  uint32_t GetN () const;
+  uint32_t Nearest (const Vector &position, double &distance) const;
+
+private:
+  std::vector<Vector> m_positions;
+  double m_minX;
+  double m_minY;
+  double m_bucketSize;
+  int32_t m_nx;
+  int32_t m_ny;
+  std::vector<uint32_t> m_bucketStart;  // CSR offsets into m_bucketCells
+  std::vector<uint32_t> m_bucketCells;
+};
+
+// Serving-cell decision of one UE, shared by the attach and traffic setup steps
+struct UeAssociation
+{
+  uint32_t macroCell;     // index in enbNodes1/enbDevs
+  double macroDistance;
+  uint32_t smallCell;     // index in enbNodes2/enbDevs2, invalid if there are no small cells
+  double smallDistance;
+  bool useSmallCell;      // closer to a small cell than to any macro sector, and within range
+};
+
+/* Propagation model of each tier, as configured on the LteHelper. Shared by
+ * the eNB install and the coupling loss estimate so they cannot diverge. */
+struct TierPathloss
+{
+  const char *model;
+  double frequency;       // [Hz]
+  double rooftopLevel;    // [m], < 0 when the model has no such attribute
+};
+
+static const TierPathloss g_tierPathloss[] = {
+  {"ns3::ItuR1411NlosOverRooftopPropagationLossModel", 800e6, 15.0},
+  {"ns3::ItuInhPropagationLossModel", 2100e6, -1},
+};
+
+std::vector<CellConfig> CellsOfTier (const std::vector<CellConfig> &cells, uint32_t tier);
+
+/* CosineAntennaModel gain read from a table sampled every 'Resolution'
+ * degrees of azimuth off boresight, linearly interpolated. The table only
+ * depends on Beamwidth, MaxGain and Resolution and is shared by all sectors
+ * with the same values. For a step h (rad) the interpolation error is at
+ * most h^2/8 max|g''| = h^2 n / (32 ln 10) / cos^2(phi/2) dB, n = 20 times
+ * the cosine exponent: 4e-4 dB at 0.5 deg within 30 dB of the peak for a
+ * 60 deg beam; RunAntennaBenchmark measures it.
+ */
+class TabulatedCosineAntennaModel : public AntennaModel
+{
+public:
+  static TypeId GetTypeId (void);
+  TabulatedCosineAntennaModel ();
+  virtual double GetGainDb (Angles a);
+
+private:
+  double m_orientation;     // [deg]
+  double m_beamwidth;       // [deg]
+  double m_maxGain;         // [dB]
+  double m_resolution;      // [deg]
+  const std::vector<double> *m_table;
+  double m_step;            // [rad]
+};
+
+/* Coupling loss between a UE and a cell: pathloss of the cell's tier minus
+ * the eNB antenna gain towards the UE (UE antennas are isotropic). Sector
+ * gains come from TabulatedCosineAntennaModel when antennaLutResolution > 0. */
+class CouplingLossModel
+{
+public:
+  CouplingLossModel (double antennaLutResolution = 0);
+  double GetLossDb (const CellConfig &cell, Ptr<MobilityModel> enb, Ptr<MobilityModel> ue);
+
+private:
+  double m_antennaLutResolution;
+  Ptr<PropagationLossModel> m_pathloss[2];
+  std::map<std::pair<double, std::pair<double, double> >, Ptr<AntennaModel> > m_antennas;
+};
+
+/* UE x cell coupling loss (pathloss of the cell's tier minus the eNB antenna
+ * gain), float32, one table per tier/carrier. Entries are computed on first
+ * use and kept until the UE or the cell reports a course change. Read by
+ * CachedCouplingLossModel, the propagation model of the LTE channels when
+ * the cache is on; the eNBs then use isotropic antennas, their gain being
+ * part of the table. Once a UE's carriers are set, links to the cells on
+ * another carrier in the link's direction (DL from the cell, UL from the UE)
+ * report CROSS_CARRIER_LOSS_DB, for the channels to cull them.
+ */
+class CouplingLossTable
+{
+public:
+  CouplingLossTable (const std::vector<CellConfig> &cells, NodeContainer macroNodes, NodeContainer smallNodes,
+                     NodeContainer ueNodes, double antennaLutResolution);
+  double GetLossDb (Ptr<MobilityModel> a, Ptr<MobilityModel> b);
+  void SetUeCarrier (Ptr<MobilityModel> ue, uint32_t dlEarfcn, uint32_t ulEarfcn);
+
+  static const double CROSS_CARRIER_LOSS_DB;
+
+private:
+  void CourseChanged (Ptr<const MobilityModel> mobility);
+
+  CouplingLossModel m_model;
+  std::vector<CellConfig> m_cells;                   // layout order
+  std::vector<Ptr<MobilityModel> > m_cellMobility;
+  std::vector<uint32_t> m_column;                    // cell -> column in its tier's table
+  uint32_t m_tierCells[2];
+  std::unordered_map<const MobilityModel *, uint32_t> m_cellOf;
+  std::unordered_map<const MobilityModel *, uint32_t> m_ueOf;
+  std::vector<std::pair<uint32_t, uint32_t> > m_ueCarrier;   // DL, UL EARFCN, 0 = any
+  std::vector<float> m_loss[2];                      // [ue * tier cells + column], NaN = not computed
+};
+
+static CouplingLossTable *g_couplingLossTable = 0;
+
+// Far above any culling threshold; the spectrum of another carrier converts
+// to zero power at the receiver anyway
+const double CouplingLossTable::CROSS_CARRIER_LOSS_DB = 1000;
+
+class CachedCouplingLossModel : public PropagationLossModel
+{
+public:
+  static TypeId GetTypeId (void);
+
+private:
+  virtual double DoCalcRxPower (double txPowerDbm, Ptr<MobilityModel> a, Ptr<MobilityModel> b) const;
+  virtual int64_t DoAssignStreams (int64_t stream);
+};
+
+/* Uplink repetitions per coverage-enhancement level (NB-IoT CE levels 0, 1
+ * and 2), modelled by scaling the UL packet size with the repetition factor.
+ * The CE level of a UE in one of the covered traffic classes comes from:
+ *   none     - level 0 for everybody;
+ *   list     - level 2 for the IMSIs of a list (one run's low-efficiency
+ *              devices), loaded from a file or the built-in list, else 0;
+ *   coupling - the coupling loss to the serving cell against two thresholds;
+ *   snr      - the noise-limited UL SNR at the serving cell against two
+ *              thresholds.
+ */
+class RepetitionPolicy
+{
+public:
+  RepetitionPolicy (std::string mode, std::string imsiFile, std::string classes,
+                    std::string thresholds, std::string repetitions);
+  bool NeedsCouplingLoss () const;
+  uint32_t GetCeLevel (uint64_t imsi, char trafficClass, double couplingLossDb, const CellConfig &servingCell) const;
+  uint32_t GetRepetitions (uint32_t ceLevel) const;
+
+private:
+  enum Mode { NONE, LIST, COUPLING, SNR };
+  Mode m_mode;
+  std::string m_classes;
+  std::unordered_set<uint64_t> m_imsis;
+  double m_thresholds[2];
+  uint32_t m_repetitions[3];
+};
+
+/* One provisioning record per UE. */
+struct ProvisioningRecord
+{
+  uint64_t imsi;
+  char trafficClass;         // 'A', 'B' or 'C'
+  uint32_t macroCell;        // nearest macro sector, 0-based
+  double macroDistance;      // [m]
+  uint32_t smallCell;        // nearest small cell, 0-based
+  double smallDistance;      // [m]
+  bool useSmallCell;         // chosen tier
+  uint32_t ceLevel;
+  bool repetition;
+};
+
+/* Provisioning log. Records go to 'file' as CSV or as fixed-size binary
+ * records ("NBP1" + 40-byte little-endian records), through a user-space
+ * buffer; an empty file name disables it. The human-readable form goes to
+ * stdout, also buffered: verbosity 0 prints nothing, 1 the
+ * "imsi, sector, class, distance, YES/NOrepeat" line, 2 adds the distances
+ * and the tier choice.
+ */
+class ProvisioningLog
+{
+public:
+  ProvisioningLog (std::string file, std::string format, uint32_t verbosity);
+  ~ProvisioningLog ();
+  void Add (const ProvisioningRecord &record);
+  void Close ();
+
+private:
+  void Flush ();
+
+  std::ofstream m_file;
+  bool m_binary;
+  uint32_t m_verbosity;
+  std::string m_buffer;
+  std::string m_text;
+};
+
+/* Fixed-width binary columnar table: "NBC1", key kind (u8: 0 per UE, 1 per
+ * cell), metric count (u32) and names (u8 length + chars); then blocks of
+ * u32 row count followed by the columns timeMs u32, ue u32, cell u16,
+ * count u32 and one f32 per metric. UEs and cells are dictionary codes; the
+ * block with row count 0xffffffff closes the file with the dictionaries
+ * (u32 n + u64 IMSIs, u32 n + u16 cell ids). */
+class ColumnarTable
+{
+public:
+  ColumnarTable (std::string file, bool perCell, const std::vector<std::string> &metrics);
+  void Add (uint32_t timeMs, uint32_t ue, uint16_t cell, uint32_t count, const double *values);
+  void Close (const std::vector<uint64_t> &imsis, const std::vector<uint16_t> &cellIds);
+
+private:
+  void FlushBlock ();
+
+  std::ofstream m_file;
+  std::vector<uint32_t> m_time;
+  std::vector<uint32_t> m_ue;
+  std::vector<uint16_t> m_cell;
+  std::vector<uint32_t> m_count;
+  std::vector<std::vector<float> > m_values;
+};
+
+/* Selective replacement of LteHelper::EnableTraces. 'spec' lists the layers
+ * to record, each optionally restricted to some metrics:
+ *   phy-dl[:rsrp+sinr], phy-ul[:sinr], mac-dl[:mcs+bytes], mac-ul[:mcs+bytes],
+ *   rlc, pdcp
+ * In "columnar" format the PHY and MAC layers go to one ColumnarTable each,
+ * aggregated per UE or per cell ('key') over 'window' seconds (0 keeps one
+ * row per event; bytes are summed, the other metrics averaged). In "text"
+ * format they use the LTE module's own stats files, which are named when the
+ * first eNB is installed, so SetTag cannot rename them. RLC and PDCP are not
+ * columnar: they always use the module's per-bearer text calculators, with
+ * 'window' as epoch, named at Install. All other outputs carry 'tag'.
+ */
+class TraceRecorder
+{
+public:
+  TraceRecorder (std::string spec, std::string format, double window, std::string key, std::string tag);
+  void SetTag (std::string tag);
+  void SkipUnusedPhySampling () const;
+  void Install (Ptr<LteHelper> lteHelper, NetDeviceContainer macroDevs, NetDeviceContainer smallDevs,
+                const std::vector<NetDeviceContainer> &ueDevs);
+  void Close ();
+
+private:
+  enum Layer { PHY_DL, PHY_UL, MAC_DL, MAC_UL, N_COLUMNAR_LAYERS };
+  struct Accumulator
+  {
+    uint32_t ue;
+    uint16_t cell;
+    uint32_t count;
+    double sums[2];
+  };
+  struct LayerTrace
+  {
+    bool enabled;
+    std::vector<uint32_t> metrics;           // selected indices into the layer's metrics
+    ColumnarTable *table;
+    std::unordered_map<uint64_t, Accumulator> window;
+  };
+  // Trace sinks are bound to one device through these taps
+  struct UeTap
+  {
+    TraceRecorder *recorder;
+    uint32_t ue;
+    void RsrpSinr (uint16_t cellId, uint16_t rnti, double rsrp, double sinr);
+    void ConnectionEstablished (uint64_t imsi, uint16_t cellId, uint16_t rnti);
+  };
+  struct CellTap
+  {
+    TraceRecorder *recorder;
+    uint16_t cell;
+    void UlSinr (uint16_t cellId, uint16_t rnti, double sinr);
+    void DlScheduling (uint32_t frame, uint32_t subframe, uint16_t rnti, uint8_t mcs1, uint16_t size1, uint8_t mcs2, uint16_t size2);
+    void UlScheduling (uint32_t frame, uint32_t subframe, uint16_t rnti, uint8_t mcs, uint16_t size);
+  };
+
+  void Record (Layer layer, uint32_t ue, uint16_t cell, double v0, double v1);
+  uint32_t UeOf (uint16_t cell, uint16_t rnti) const;
+  void EndWindow ();
+
+  bool m_columnar;
+  bool m_perCell;
+  double m_window;
+  std::string m_tag;
+  bool m_rlc;
+  bool m_pdcp;
+  LayerTrace m_layers[N_COLUMNAR_LAYERS];
+  std::vector<UeTap> m_ueTaps;
+  std::vector<CellTap> m_cellTaps;
+  std::vector<uint64_t> m_imsis;             // UE dictionary
+  std::vector<uint16_t> m_cellIds;           // cell dictionary
+  std::unordered_map<uint32_t, uint32_t> m_rntiToUe;    // (cell code << 16 | rnti) -> UE code
+};
+
+/* Periodic flow report. Received packets of every UE flow (DL sinks and
+ * the uplink collector) are accumulated per group (direction, traffic
+ * class, serving cell); every interval one line per group that received
+ * traffic gives throughput, delivered and lost packets (SeqTsHeader sequence
+ * gaps) and latency percentiles from a log-binned histogram (8 bins per
+ * octave, so within 9%). The work per interval is proportional to the
+ * groups that changed.
+ */
+class FlowReporter
+{
+public:
+  FlowReporter (std::string file, double interval);
+  void AddDownlinkFlow (Ptr<Application> sink, char trafficClass, uint16_t cellId);
+  void AddUplinkFlow (uint64_t imsi, char trafficClass, uint16_t cellId);
+  void UplinkRx (uint64_t imsi, Ptr<const Packet> packet);
+  void Close ();
+
+private:
+  static const uint32_t LATENCY_BINS = 256;
+  struct Group
+  {
+    bool uplink;
+    char trafficClass;
+    uint16_t cellId;
+    bool dirty;
+    uint32_t rxPackets;
+    uint64_t rxBytes;
+    uint32_t lost;
+    std::vector<uint32_t> latency;         // histogram of log2 [us] * 8
+  };
+  struct Flow
+  {
+    FlowReporter *reporter;
+    uint32_t group;
+    uint32_t nextSeq;
+    void SinkRx (Ptr<const Packet> packet, const Address &from);
+  };
+
+  uint32_t GroupOf (bool uplink, char trafficClass, uint16_t cellId);
+  void Receive (Flow &flow, Ptr<const Packet> packet);
+  double Percentile (const Group &group, double p) const;
+  void Report ();
+
+  bool m_enabled;
+  Time m_interval;
+  Time m_last;
+  std::ofstream m_file;
+  std::deque<Flow> m_flows;                // stable addresses, bound to the sink traces
+  std::vector<uint32_t> m_ulFlowOfImsi;    // IMSI -> flow index + 1
+  std::vector<Group> m_groups;
+  std::map<uint32_t, uint32_t> m_groupOf;
+  std::vector<uint32_t> m_dirty;
+};
+
+/* Uplink sink for all UEs: one UDP socket on the remote host. Packets are
+ * attributed to a UE by source address and counted in a flat array indexed
+ * by IMSI; loss comes from gaps in the per-flow sequence numbers and latency
+ * from its timestamp (SeqTsHeader).
+ */
+class UplinkCollector : public Application
+{
+public:
+  static TypeId GetTypeId (void);
+  UplinkCollector ();
+  void AddUe (Ipv4Address address, uint64_t imsi);
+  void Report (std::string file) const;
+  void AddRxCallback (Callback<void, uint64_t, Ptr<const Packet> > rx);
+  void GetTotals (uint64_t &rxPackets, uint64_t &lost, double &meanLatencyMs) const;
+
+private:
+  struct UeCounters
+  {
+    uint32_t rxPackets;
+    uint64_t rxBytes;
+    uint32_t nextSeq;
+    uint32_t lost;
+    uint32_t reordered;
+    int64_t latencySum;      // [ns]
+    int64_t latencyMax;      // [ns]
+  };
+
+  virtual void StartApplication (void);
+  virtual void StopApplication (void);
+  void HandleRead (Ptr<Socket> socket);
+
+  uint16_t m_port;
+  Ptr<Socket> m_socket;
+  std::unordered_map<uint32_t, uint64_t> m_imsiOf;    // IPv4 address -> IMSI
+  std::vector<UeCounters> m_ues;
+  uint64_t m_unknown;
+  std::vector<Callback<void, uint64_t, Ptr<const Packet> > > m_rx;
+};
+
+/* Network-side DL reachability per traffic class, spec
+ * "A=inactivity:edrx:active:tau,..." [s], after the idle-mode timers of an
+ * NB-IoT UE: 'inactivity' after its last traffic the UE counts as released
+ * and reachable only at its paging occasions, every 'edrx'; 'active' after
+ * the release (T3324) it is unreachable (PSM) until its next uplink report
+ * or the periodic TAU, 'tau' after the release (T3412, 0 = none), which
+ * starts a new cycle. Only the downlink of the covered classes follows these
+ * timers: their DL packets are held by the network and sent (SeqTsHeader,
+ * like UdpClient) as soon as the UE is reachable. The simulated UE stays
+ * RRC-connected throughout, its PHY, MAC, CQI/SRS and uplink keep running,
+ * so this is a DL hold model, not an event saving: it adds at most one
+ * pending delivery per UE with data held. Per-UE time in each reachability
+ * state, TAUs, wake-ups and DL hold time go to a CSV report.
+ */
+class DlReachabilityModel
+{
+public:
+  DlReachabilityModel (std::string spec);
+  bool Covers (char trafficClass) const;
+  void Install (Ptr<Node> remoteHost, uint16_t dlPort);
+  void AddUe (uint64_t imsi, char trafficClass, Ipv4Address address, Time dlStart, Time dlInterval, uint32_t dlSize);
+  void UplinkRx (uint64_t imsi, Ptr<const Packet> packet);
+  void Report (std::string file);
+
+private:
+  enum State { REACHABLE, PAGING, UNREACHABLE, N_STATES };
+  // Times in ns
+  struct Profile
+  {
+    char trafficClass;
+    int64_t inactivity;
+    int64_t edrx;
+    int64_t active;
+    int64_t tau;
+  };
+  struct Ue
+  {
+    uint64_t imsi;
+    uint32_t profile;
+    Ipv4Address address;
+    int64_t dlInterval;
+    uint32_t dlSize;
+    int64_t nextDue;       // due time of the oldest DL packet not sent yet
+    int64_t cycleStart;    // last wake-up: report, delivery or TAU
+    int64_t accounted;     // state times are summed up to here
+    uint32_t seq;
+    EventId delivery;
+    double seconds[N_STATES];
+    uint32_t taus;
+    uint32_t wakes;
+    uint32_t dlPackets;
+    double holdSeconds;
+  };
+
+  void Account (Ue &ue, int64_t now);
+  int64_t Reachable (const Ue &ue, int64_t t) const;
+  void ScheduleDelivery (uint32_t index);
+  void Deliver (uint32_t index);
+
+  std::vector<Profile> m_profiles;
+  std::vector<Ue> m_ues;
+  std::vector<uint32_t> m_ueOfImsi;       // index + 1, 0 = not covered
+  Ptr<Socket> m_socket;
+  uint16_t m_dlPort;
+};
+
+/* Start times of the applications of one traffic class, one draw per
+ * client/sink pair. "uniform[:max]" spreads the starts over [0, max) s;
+ * "slotted:slot[:jitter]" picks one of the reporting slots that fit in max and
+ * adds a uniform jitter in [0, jitter) s. max defaults to the value given to
+ * the constructor. Schedule () returns the start time.
+ */
+class StartTimeScheduler
+{
+public:
+  StartTimeScheduler (std::string spec, double defaultMax);
+  Time Schedule (ApplicationContainer sink, ApplicationContainer client);
+
+private:
+  Ptr<UniformRandomVariable> m_rv;
+  bool m_slotted;
+  double m_max;
+  double m_slot;
+  double m_jitter;
+};
+
+/* Payload size of a report [B]: "n", "uniform:min:max", "exp:mean" or
+ * "normal:mean:sd", drawn per report; never below the 12 B SeqTsHeader. */
+struct PayloadSize
+{
+  enum Kind { CONSTANT, UNIFORM, EXPONENTIAL, NORMAL } kind;
+  double a;
+  double b;
+
+  static PayloadSize Parse (std::string spec);
+  double GetMean () const;
+};
+
+/* One traffic class: a share of numberOfNodes and the reports of its UEs.
+ * CSV columns: label,share,arrival,period,jitter,start,direction,ulSize,dlSize
+ * 'label' is the class letter repetitionClasses and dlReachability refer to;
+ * 'arrival' is periodic (every 'period' s from the UE's start, each report
+ * delayed off that grid by a uniform [0, jitter) s) or poisson (exponential
+ * gaps of mean 'period' s, e.g. event-triggered alarms); 'start' is a
+ * StartTimeScheduler spec; 'direction' is ul, dl or both; the sizes are
+ * PayloadSize specs, '-' for an unused direction.
+ */
+struct TrafficClass
+{
+  char label;
+  double share;
+  bool poisson;
+  double period;          // [s]
+  double jitter;          // [s]
+  std::string start;
+  bool ul;
+  bool dl;
+  PayloadSize ulSize;
+  PayloadSize dlSize;
+};
+
+std::vector<TrafficClass> LoadTrafficMix (std::string fileName);
+
+/* The built-in mix: classes A, B and C with 10/80/10 % of the UEs, reporting
+ * 240 B UL and 240/200/200 B DL every intervals[c] ms. */
+std::vector<TrafficClass> DefaultTrafficMix (const double intervals[3], const std::string starts[3], uint32_t ulSize);
+
+/* All reports of one traffic class from a single hashed timer wheel of 1 ms
+ * slots (one subframe): one simulator event per occupied slot sends every UL
+ * and DL report due in it, instead of one UdpClient and event chain per UE
+ * and direction, so the event queue holds one entry per class. Reports carry
+ * a per-flow SeqTsHeader and are padded to their size like UdpClient's; UL
+ * ones leave the UE's own socket, DL ones one remote host socket per class.
+ */
+class TrafficWheel : public SimpleRefCount<TrafficWheel>
+{
+public:
+  TrafficWheel (const TrafficClass &traffic, Ptr<Node> remoteHost, Address ulDestination, uint16_t dlPort);
+  void AddUplink (Ptr<Node> ue, Time start, uint32_t sizeScale);
+  void AddDownlink (Ipv4Address ue, Time start);
+  uint32_t GetFlows () const;
+
+private:
+  struct Flow
+  {
+    Ptr<Socket> socket;     // UL: the UE's, connected; DL: 0
+    Ipv4Address address;    // DL destination
+    uint32_t sizeScale;
+    uint32_t seq;
+    int64_t nominal;        // report time before jitter [ns]
+    uint64_t due;           // [slots]
+  };
+
+  void Add (const Flow &flow, Time start);
+  void Insert (uint32_t flow);
+  void Arm ();
+  void Fire ();
+  void Send (Flow &flow);
+
+  TrafficClass m_traffic;
+  Address m_ulDestination;
+  Ptr<Socket> m_dlSocket;
+  uint16_t m_dlPort;
+  Ptr<UniformRandomVariable> m_uniform;
+  Ptr<ExponentialRandomVariable> m_exponential;
+  Ptr<NormalRandomVariable> m_normal;
+  std::vector<Flow> m_flows;
+  std::vector<std::vector<uint32_t> > m_slots;   // flows by due % slots
+  uint64_t m_now;                                // slot fired last
+  EventId m_event;
+  uint64_t m_armed;                              // slot of m_event
+};
+
+/* Attaches the UEs of all containers in one ordered batch (container order,
+ * then device order). Serving cells are computed by 'workers' threads (0 = one
+ * per core) over a snapshot of the UE positions, and all of them are known
+ * before any attachment is issued, so the result does not depend on the
+ * number of threads. Returns the associations per container.
+ */
+std::vector<std::vector<UeAssociation> > BulkAttach (Ptr<LteHelper> lteHelper, const std::vector<NetDeviceContainer> &ueDevs,
+                                                     NetDeviceContainer macroDevs, NetDeviceContainer smallDevs,
+                                                     const CellGridIndex &macroIndex, const CellGridIndex &smallIndex,
+                                                     double smallCellRange, uint32_t workers);
+
+/* Runs the scenario over a parameter grid ("name=v1,v2;name=v1,...", any
+ * option of this script) times 'replications' RngRun seeds, each run in its
+ * own worker process (this executable, with 'baseArgs' and --kpiFile).
+ * At most 'jobs' workers run at once (0 = one per core), fewer if their
+ * peak RSS, learnt from the finished ones, would exceed 'memoryMb'. The KPIs
+ * of all runs are merged into 'output', one line per grid point with the
+ * mean and 95% confidence half-width of each KPI. Returns the number of
+ * failed runs.
+ */
+int RunSweep (const char *program, const std::vector<std::string> &baseArgs, std::string grid,
+              uint32_t replications, uint32_t jobs, double memoryMb, double workerMb, std::string output);
+
+/* Scaling benchmark: runs this scenario (with 'baseArgs') over 'matrix', a
+ * sweep grid in which "cells=n,..." stands for the default layout densified
+ * to n cells, one run at a time so wall times are not shared. The KPIs of
+ * every point (wall time, simulated seconds per wall second, events per
+ * second, peak RSS, output bytes) go to 'output' and are compared with
+ * 'baseline', the output of an earlier run, which is written instead if it
+ * does not exist yet and no run failed. Returns the number of failed runs plus the number of
+ * KPIs more than 'tolerance' (relative) worse than the baseline.
+ */
+int RunScalingBenchmark (const char *program, const std::vector<std::string> &baseArgs, std::string matrix,
+                         std::string baseline, double tolerance, std::string output);
+
+/* The built-in layout with small cells added, uniformly over the UE area
+ * (fixed seed), until it has 'cells' cells. */
+std::vector<CellConfig> DensifiedTopology (uint32_t cells);
+
+/* Bytes of the files in the working directory whose name contains 'tag' (not
+ * followed by a digit) and that were modified since 'since': the output of
+ * this run. */
+uint64_t OutputBytes (std::string tag, time_t since);
+
+/* Forks one child process per variant, at most 'jobs' (0 = one per core) at
+ * a time. Returns the variant index in the child. The parent waits for all
+ * children and returns -1, with the number of failed ones in 'failed'.
+ */
+int ForkVariants (uint32_t variants, uint32_t jobs, uint32_t &failed);
+
+/* The UEs of 'ues' that the attach step will serve from the small-cell tier
+ * ('small') or from the macro tier. */
+NodeContainer UesOfTier (NodeContainer ues, const CellGridIndex &macroIndex, const CellGridIndex &smallIndex,
+                         double smallCellRange, bool small);
+
+/* Merges the KPI files of the per-tier processes of a partitioned run,
+ * '<file><tag>_tier1' and '_tier2', into 'file': counts and throughputs add
+ * up, ratios and latencies are weighted by packets, wall time is the given
+ * one. */
+void MergeTierKpis (std::string file, std::string tag, double wallSeconds);
+
+/* Receiver culling threshold: the largest coupling loss [dB] at which a cell
+ * of the layout (power spread over its DL RBs, UE noise figure) or a UE (full
+ * power in one RB, eNB noise figure) still reaches 'marginDb' below the
+ * thermal noise of an RB. */
+double CullingMaxLossDb (const std::vector<CellConfig> &cells, double marginDb);
+
+/* Restricts each attached UE to the DL and UL carriers of its serving cell in
+ * 'table' and writes to 'file' what culling at 'maxLossDb' costs: per UE the
+ * DL SINR error of dropping the cells on its DL carrier beyond it (all cells
+ * transmitting, as the control region does), per cell an upper bound of the
+ * UL one (the strongest culled UE on its UL carrier of every other cell, on
+ * the same RB). Prints a summary.
+ */
+void CullReceivers (CouplingLossTable &table, double maxLossDb, std::string file,
+                    const std::vector<CellConfig> &cells, NodeContainer macroNodes, NodeContainer smallNodes,
+                    const std::vector<NetDeviceContainer> &ueDevs,
+                    const std::vector<std::vector<UeAssociation> > &associations);
+
+/* Named phases of one run. Mark () closes the current phase and opens the
+ * next; each phase records wall and CPU time, the growth of the peak RSS and
+ * of the heap, and the node/device/application counts at its end. Write ()
+ * closes the last phase and emits the phases as JSON.
+ */
+class PhaseProfiler
+{
+public:
+  PhaseProfiler ();
+  void Mark (std::string phase);
+  void Write (std::string file);
+
+private:
+  struct Sample
+  {
+    std::chrono::steady_clock::time_point wall;
+    double cpu;              // [s]
+    long peakRss;            // [kB]
+    size_t heap;             // [B]
+  };
+  struct Phase
+  {
+    std::string name;
+    double wallSeconds;
+    double cpuSeconds;
+    long peakRssDelta;
+    double heapDelta;
+    uint32_t nodes;
+    uint32_t devices;
+    uint32_t applications;
+  };
+  static Sample Take ();
+  void Close ();
+
+  std::string m_current;
+  Sample m_start;
+  Sample m_first;
+  std::vector<Phase> m_phases;
+};
+
+/* Hands the CE level of each UE to the NbIotFfMacScheduler of its serving
+ * cell, whichever comes last: the level from the traffic setup or the RNTI
+ * from the RRC connection (or handover).
+ */
+class CeLevelNotifier
+{
+public:
+  void AddCells (NetDeviceContainer enbDevs);
+  void SetCeLevel (uint64_t imsi, uint32_t ceLevel);
+  void ConnectionEstablished (uint64_t imsi, uint16_t cellId, uint16_t rnti);
+
+private:
+  void Apply (uint64_t imsi);
+
+  std::unordered_map<uint16_t, Ptr<NbIotFfMacScheduler> > m_schedulers;   // by cell ID
+  std::unordered_map<uint64_t, uint32_t> m_ceLevels;
+  std::unordered_map<uint64_t, std::pair<uint16_t, uint16_t> > m_connections;   // cell ID, RNTI
+};
+
+/* Per-subframe cost of the uplink+downlink trigger of PfFfMacScheduler and
+ * NbIotFfMacScheduler at 100, 1k and 10k attached UEs per cell, driven
+ * through their SAPs with sensor traffic (one 240 B BSR per UE per
+ * 'interval' ms). */
+int RunSchedulerBenchmark (uint32_t subframes, double interval);
+
+/* Times LteAmc (one CreateCqiFeedbacks per UE report) against BatchAmc on a
+ * 12-RB carrier, 'reports' rounds of 'ues' UEs, and checks that every CQI,
+ * MCS and TBS is the same. Returns 1 on a mismatch. */
+int RunAmcBenchmark (uint32_t ues, uint32_t reports);
+
+/* Bytes currently allocated on the heap, for the per-UE footprint report. */
+size_t HeapInUse ();
+
+/* Compares TabulatedCosineAntennaModel with CosineAntennaModel for the sector
+ * parameters of the default layout: time per call and maximum error. */
+int RunAntennaBenchmark (uint32_t samples, double resolution);
 
 int main (int argc, char *argv[])
 {
-        uint16_t numberOfNodes = 2500;
+        uint32_t numberOfNodes = 2500;
         double simTime = 30;
         double interPacketIntervalOne = 24000;
 	double interPacketIntervalTwo = 2000;
 	double interPacketIntervalThree = 1000;
         uint32_t pacchetto = 12*20;	
+	std::string topologyFile = "";
+	std::string saveTopologyFile = "";
+	double smallCellRange = 150;
+	uint32_t attachThreads = 0;
+	std::string startOne = "uniform";
+	std::string startTwo = "uniform";
+	std::string startThree = "uniform";
+	std::string trafficMix = "";
+	std::string repetitionMode = "list";
+	std::string repetitionImsiFile = "";
+	std::string repetitionClasses = "BC";
+	std::string ceThresholds = "";
+	std::string ceRepetitions = "1:8:32";
+	std::string provisioningLog = "";
+	std::string provisioningFormat = "csv";
+	uint32_t provisioningVerbosity = 2;
+	std::string traces = "phy-dl,phy-ul,mac-dl,mac-ul,rlc,pdcp";
+	std::string traceFormat = "columnar";
+	double traceWindow = 1.0;
+	std::string traceKey = "ue";
+	std::string ulStatsFile = "";
+	double flowReportInterval = 0;
+	std::string kpiFile = "";
+	std::string outputTag = "";
+	bool couplingLossCache = false;
+	double antennaLut = 0;
+	bool staticUeStack = false;
+	std::string scheduler = "pf";
+	std::string dlReachability = "";
+	double warmUp = 0;
+	std::string fanOut = "";
+	bool phaseReport = true;
+	bool skipUntracedPhySampling = false;
+	bool partitionTiers = false;
+	bool receiverCulling = false;
+	double cullMargin = 10;
+	bool eventProfile = false;
+	std::string eventScheduler = "map";
+	bool eventQueueBenchmark = false;
+	std::string scalingBenchmark = "";
+	std::string scalingMatrix = "numberOfNodes=1000,2500,10000,50000;cells=30,60;simTime=10,30;traces=all,none";
+	double scalingTolerance = 0.25;
+	uint32_t antennaBenchmark = 0;
+	uint32_t schedulerBenchmark = 0;
+	uint32_t amcBenchmark = 0;
+	std::string sweep = "";
+	uint32_t replications = 1;
+	uint32_t sweepJobs = 0;
+	double sweepMemoryMb = 0;
+	double sweepWorkerMb = 2048;
+	std::string sweepOutput = "sweep.csv";
 									
 	CommandLine cmd;
 	cmd.AddValue("numberOfNodes", "Number of eNodeBs + UE pairs", numberOfNodes);
@@ -46,7 +884,108 @@ int main (int argc, char *argv[])
  	cmd.AddValue("interPacketIntervalOne", "Inter packet interval two [ms])", interPacketIntervalOne);
  	cmd.AddValue("interPacketIntervalTwo", "Inter packet interval one [ms])", interPacketIntervalTwo);
  	cmd.AddValue("interPacketIntervalThree", "Inter packet interval one [ms])", interPacketIntervalThree);
+	cmd.AddValue("topology", "Cell layout file, CSV or binary (.bin); empty for the built-in 2-tier layout", topologyFile);
+	cmd.AddValue("smallCellRange", "Max distance [m] at which a UE closer to a small cell attaches to it", smallCellRange);
+	cmd.AddValue("attachThreads", "Worker threads for the serving-cell computation (0 = one per core)", attachThreads);
+	cmd.AddValue("startOne", "Start-time distribution of class One: uniform[:max] or slotted:slot[:jitter] [s]", startOne);
+	cmd.AddValue("startTwo", "Start-time distribution of class Two", startTwo);
+	cmd.AddValue("startThree", "Start-time distribution of class Three", startThree);
+	cmd.AddValue("trafficMix", "Traffic classes from this CSV file (empty: A/B/C from the interval and start options)", trafficMix);
+	cmd.AddValue("repetitionMode", "UL repetition policy: none, list, coupling or snr", repetitionMode);
+	cmd.AddValue("repetitionImsiFile", "IMSIs allowed to repeat in list mode (default: built-in list)", repetitionImsiFile);
+	cmd.AddValue("repetitionClasses", "Traffic classes (A, B, C) the repetition policy applies to", repetitionClasses);
+	cmd.AddValue("ceThresholds", "CE level 1 and 2 thresholds, coupling loss [dB] or SNR [dB] (default 144:154 or 0:-10)", ceThresholds);
+	cmd.AddValue("ceRepetitions", "Repetition factor of CE levels 0, 1 and 2", ceRepetitions);
+	cmd.AddValue("provisioningLog", "Per-UE provisioning log file (empty: none)", provisioningLog);
+	cmd.AddValue("provisioningFormat", "Provisioning log format: csv or binary", provisioningFormat);
+	cmd.AddValue("provisioningVerbosity", "Per-UE provisioning lines on stdout: 0 none, 1 summary, 2 with tier choice", provisioningVerbosity);
+	cmd.AddValue("traces", "Trace layers[:metrics], e.g. phy-dl:sinr,mac-ul:bytes,rlc, or all/none", traces);
+	cmd.AddValue("traceFormat", "PHY/MAC trace format: columnar or text (RLC/PDCP are always per-bearer text files)", traceFormat);
+	cmd.AddValue("traceWindow", "Trace aggregation window [s], 0 for one row per event", traceWindow);
+	cmd.AddValue("traceKey", "Columnar trace aggregation key: ue or cell", traceKey);
+	cmd.AddValue("ulStatsFile", "Per-UE uplink counters written by the collector (empty: none)", ulStatsFile);
+	cmd.AddValue("flowReportInterval", "Per class/cell flow report period [s] (0: none)", flowReportInterval);
+	cmd.AddValue("couplingLossCache", "Serve UE-eNB propagation from a precomputed coupling loss table. Changes the physics: each tier gets its own pathloss model, while by default both channels use the one of the first eNB install (macro)", couplingLossCache);
+	cmd.AddValue("antennaLut", "Sector gains from a table with this resolution [deg] (0: analytic)", antennaLut);
+	cmd.AddValue("skipUntracedPhySampling", "Raise the RSRP/SINR and interference sample periods of the PHY traces that are not recorded (the PHYs still tick every subframe)", skipUntracedPhySampling);
+	cmd.AddValue("dlReachability", "Hold the DL of a class by idle-mode timers (the UEs stay connected): A=inactivity:edrx:active:tau[,...] [s]", dlReachability);
+	cmd.AddValue("partitionTiers", "Run each carrier tier, with the UEs it serves, in its own process", partitionTiers);
+	cmd.AddValue("receiverCulling", "Deliver signals only to receivers they can reach above the noise floor minus cullMargin", receiverCulling);
+	cmd.AddValue("cullMargin", "Culling margin below the thermal noise of an RB [dB]", cullMargin);
+	cmd.AddValue("scheduler", "MAC scheduler: pf (ns-3 PfFfMacScheduler) or nbiot (NPUSCH resource units with repetitions)", scheduler);
+	cmd.AddValue("schedulerBenchmark", "Time both schedulers over this many subframes at 100, 1k and 10k UEs per cell, then exit", schedulerBenchmark);
+	cmd.AddValue("amcBenchmark", "Time and check batched against scalar AMC for this many UEs on 12 RBs, then exit", amcBenchmark);
+	cmd.AddValue("antennaBenchmark", "Time and check the sector gain table over this many angles, then exit", antennaBenchmark);
+	cmd.AddValue("staticUeStack", "IPv4-only, statically routed UE stack, no handover algorithm or ANR state", staticUeStack);
+	cmd.AddValue("warmUp", "Run the attached network this long [s] before installing the traffic", warmUp);
+	cmd.AddValue("fanOut", "After warm-up, fork one run per variant: 'opt=v;opt=v|opt=v...'", fanOut);
+	cmd.AddValue("phaseReport", "Write per-phase time/memory to PhaseReport<tag>.json", phaseReport);
+	cmd.AddValue("eventProfile", "Profile every simulator event (EventProfile<tag>.csv), slows the run down", eventProfile);
+	cmd.AddValue("eventScheduler", "Event queue: map, list, heap, calendar (ns-3) or bucket (auto-tuned calendar)", eventScheduler);
+	cmd.AddValue("eventQueueBenchmark", "Sweep 2500 and 25000 UEs over the map, list, heap and bucket event queues into sweepOutput, one run at a time", eventQueueBenchmark);
+	cmd.AddValue("scalingBenchmark", "Run scalingMatrix and compare with this baseline file (written if missing)", scalingBenchmark);
+	cmd.AddValue("scalingMatrix", "Sweep grid of the scaling benchmark; cells=n densifies the default layout", scalingMatrix);
+	cmd.AddValue("scalingTolerance", "Relative KPI degradation the scaling benchmark accepts", scalingTolerance);
+	cmd.AddValue("kpiFile", "Write this run's KPIs as 'name value' lines (empty: none)", kpiFile);
+	cmd.AddValue("outputTag", "Suffix of this run's output file names (empty: _rngRun<RngRun>)", outputTag);
+	cmd.AddValue("sweep", "Parameter grid to sweep, e.g. numberOfNodes=1000,2500;smallCellRange=100,150", sweep);
+	cmd.AddValue("replications", "RngRun seeds (1..n) per sweep point", replications);
+	cmd.AddValue("sweepJobs", "Concurrent sweep workers (0: one per core)", sweepJobs);
+	cmd.AddValue("sweepMemoryMb", "Memory budget of all sweep workers together [MB] (0: none)", sweepMemoryMb);
+	cmd.AddValue("sweepWorkerMb", "Assumed worker peak memory until one has finished [MB]", sweepWorkerMb);
+	cmd.AddValue("sweepOutput", "Merged sweep results", sweepOutput);
+	cmd.AddValue("saveTopology", "Write the cell layout in binary form for fast loading", saveTopologyFile);
   	cmd.Parse (argc, argv);
+	// Single-word forms, which also fit in a sweep grid
+	if (traces == "all")
+		traces = "phy-dl,phy-ul,mac-dl,mac-ul,rlc,pdcp";
+	else if (traces == "none")
+		traces = "";
+
+	if (antennaBenchmark > 0)
+		return RunAntennaBenchmark (antennaBenchmark, antennaLut > 0 ? antennaLut : 0.5);
+	if (schedulerBenchmark > 0)
+		return RunSchedulerBenchmark (schedulerBenchmark, interPacketIntervalOne);
+	if (amcBenchmark > 0)
+		return RunAmcBenchmark (amcBenchmark, 100);
+	if (!scalingBenchmark.empty ())
+	{
+		std::vector<std::string> baseArgs;
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg.compare (0, 9, "--scaling") != 0 && arg.compare (0, 7, "--sweep") != 0)
+				baseArgs.push_back (arg);
+		}
+		return RunScalingBenchmark (argv[0], baseArgs, scalingMatrix, scalingBenchmark, scalingTolerance,
+		                            sweepOutput) > 0;
+	}
+	if (eventQueueBenchmark)
+	{
+		// Events per second of this scenario (eventsPerSecond KPI) per queue,
+		// all other options as given
+		NS_ABORT_MSG_UNLESS (sweep.empty (), "eventQueueBenchmark brings its own sweep");
+		sweep = "numberOfNodes=2500,25000;eventScheduler=map,list,heap,bucket";
+		// One run at a time: concurrent runs share cores and memory bandwidth,
+		// which would skew the timings between the queues
+		sweepJobs = 1;
+	}
+	if (!sweep.empty () || replications > 1)
+	{
+		std::vector<std::string> baseArgs;
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg.compare (0, 7, "--sweep") != 0 && arg.compare (0, 14, "--replications") != 0
+			    && arg.compare (0, 21, "--eventQueueBenchmark") != 0)
+				baseArgs.push_back (arg);
+		}
+		return RunSweep (argv[0], baseArgs, sweep, replications, sweepJobs, sweepMemoryMb, sweepWorkerMb, sweepOutput) > 0;
+	}
+	std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now ();
+	time_t startTime = std::time (0);
+	PhaseProfiler phases;
+	phases.Mark ("core");
 
 	Time::SetResolution (Time::NS);
 
@@ -54,7 +993,32 @@ int main (int argc, char *argv[])
   	GlobalValue::GetValueByName ("RngRun", runValue);
 
 	std::ostringstream tag;
-  	tag << "_rngRun"  << std::setw (3) << std::setfill ('0')  << runValue.Get () ;
+	if (outputTag.empty ())
+		tag << "_rngRun" << std::setw (3) << std::setfill ('0') << runValue.Get ();
+	else
+		tag << outputTag;
+
+	// Before anything touches the simulator, which creates the implementation
+	if (eventProfile)
+	{
+		GlobalValue::Bind ("SimulatorImplementationType", StringValue ("ns3::ProfilingSimulatorImpl"));
+		ProfilingSimulatorImpl::SetReportName ("EventProfile" + tag.str ());
+	}
+	static const char *queueTypes[][2] = {{"map", "ns3::MapScheduler"}, {"list", "ns3::ListScheduler"},
+	                                      {"heap", "ns3::HeapScheduler"}, {"calendar", "ns3::CalendarScheduler"},
+	                                      {"bucket", "ns3::BucketScheduler"}};
+	uint32_t queueType = 0;
+	while (queueType < 5 && eventScheduler != queueTypes[queueType][0])
+		++queueType;
+	NS_ABORT_MSG_IF (queueType == 5, "Unknown event scheduler: " << eventScheduler);
+	GlobalValue::Bind ("SchedulerType", StringValue (queueTypes[queueType][1]));
+
+	// Must precede the first eNB install, which creates the stats calculators
+	TraceRecorder traceRecorder (traces, traceFormat, traceWindow, traceKey, tag.str ());
+	// The PHYs still tick every subframe, but without the per-UE RSRP/SINR
+	// and interference sampling behind traces that are not recorded
+	if (skipUntracedPhySampling)
+		traceRecorder.SkipUnusedPhySampling ();
 
 	//Configure the LTE+EPC system
 
@@ -63,11 +1027,25 @@ int main (int argc, char *argv[])
   	lteHelper->SetEpcHelper (epcHelper);
   	//epcHelper->Initialize ();
 
-  	lteHelper->SetSchedulerType("ns3::PfFfMacScheduler");
+	NS_ABORT_MSG_UNLESS (scheduler == "pf" || scheduler == "nbiot", "Unknown scheduler: " << scheduler);
+	bool nbiotScheduler = scheduler == "nbiot";
+	if (nbiotScheduler)
+	{
+		lteHelper->SetSchedulerType ("ns3::NbIotFfMacScheduler");
+		lteHelper->SetSchedulerAttribute ("Repetitions", StringValue (ceRepetitions));
+	}
+	else
+  		lteHelper->SetSchedulerType("ns3::PfFfMacScheduler");
   	Config::SetDefault ("ns3::LteAmc::AmcModel", EnumValue (LteAmc::PiroEW2010)); 
   	Config::SetDefault ("ns3::LteEnbRrc::DefaultTransmissionMode", UintegerValue (0)); // 0=SISO; 1=SIMO; 2=MIMO OPEN 
 											   //LOOP; 3=MIMO CLOSED LOOP; 
 											   //4=MIMO MULTI-USER
+	if (staticUeStack)
+	{
+		// Static sensors: no handover measurements or neighbour relations kept per UE
+		lteHelper->SetHandoverAlgorithmType ("ns3::NoOpHandoverAlgorithm");
+		lteHelper->SetAttribute ("AnrEnabled", BooleanValue (false));
+	}
   	
   	
 	ConfigStore inputConfig;
@@ -103,316 +1081,103 @@ int main (int argc, char *argv[])
 
   	Ipv4StaticRoutingHelper ipv4RoutingHelper;
   	Ptr<Ipv4StaticRouting> remoteHostStaticRouting = ipv4RoutingHelper.GetStaticRouting (remoteHost->GetObject<Ipv4> ());
-  	remoteHostStaticRouting->AddNetworkRouteTo (Ipv4Address ("7.0.0.0"), Ipv4Mask ("255.255.255.0"), 1);
+  	// The EPC assigns the UE addresses from all of 7.0.0.0/8
+  	remoteHostStaticRouting->AddNetworkRouteTo (Ipv4Address ("7.0.0.0"), Ipv4Mask ("255.0.0.0"), 1);
+
+	phases.Mark ("mobility");
+
+	// Cell layout: built-in 2-tier layout unless --topology is given
+
+	std::vector<CellConfig> cells = topologyFile.empty () ? DefaultTopology () : LoadTopology (topologyFile);
+	if (!saveTopologyFile.empty ())
+		SaveTopology (saveTopologyFile, cells);
+
+	// Traffic classes, one UE group each
+
+	double intervals[] = {interPacketIntervalOne, interPacketIntervalTwo, interPacketIntervalThree};
+	std::string starts[] = {startOne, startTwo, startThree};
+	std::vector<TrafficClass> mix = trafficMix.empty () ? DefaultTrafficMix (intervals, starts, pacchetto)
+	                                                     : LoadTrafficMix (trafficMix);
 
 	//Create UEs and eNB, with mobility model
 
-	NodeContainer ueNodesOne;
-	NodeContainer ueNodesTwo;
-	NodeContainer ueNodesThree;
+	std::vector<NodeContainer> ueNodesByClass (mix.size ());
   	NodeContainer enbNodes1;
 	NodeContainer enbNodes2;
-  	enbNodes1.Create(15);
-	enbNodes2.Create(15);
-        ueNodesOne.Create(0.1*numberOfNodes);
-        ueNodesTwo.Create(0.8*numberOfNodes);
-        ueNodesThree.Create(0.1*numberOfNodes);
+	enbNodes1.Create (CountCells (cells, 1));
+	enbNodes2.Create (CountCells (cells, 2));
+	for (uint32_t c = 0; c < mix.size (); ++c)
+		ueNodesByClass[c].Create (mix[c].share * numberOfNodes);
 
 	Config::SetDefault ("ns3::LteEnbRrc::SrsPeriodicity", UintegerValue (320));
 	Config::SetDefault ("ns3::LteUePhy::TxPower", DoubleValue (23.0));
 	Config::SetDefault ("ns3::LteEnbPhy::TxPower", DoubleValue (43.0));
 
 
-	//macro mobility
-
-	Ptr<ListPositionAllocator> positionAlloc1One = CreateObject<ListPositionAllocator> ();
-	positionAlloc1One->Add (Vector(1.0, 0.17, 23.0));
-	MobilityHelper mobilityENB1One;
-	mobilityENB1One.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB1One.SetPositionAllocator (positionAlloc1One);
-	mobilityENB1One.Install (enbNodes1.Get(0));
-	
-	Ptr<ListPositionAllocator> positionAlloc1Two = CreateObject<ListPositionAllocator> ();
-	positionAlloc1Two->Add (Vector(-0.5, 0.86, 23.0));
-	MobilityHelper mobilityENB1Two;
-	mobilityENB1Two.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB1Two.SetPositionAllocator (positionAlloc1Two);
-	mobilityENB1Two.Install (enbNodes1.Get(1));
-	
-	Ptr<ListPositionAllocator> positionAlloc1Three = CreateObject<ListPositionAllocator> ();
-	positionAlloc1Three->Add (Vector(0.17, -0.98, 23.0));
-	MobilityHelper mobilityENB1Three;
-	mobilityENB1Three.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB1Three.SetPositionAllocator (positionAlloc1Three);
-	mobilityENB1Three.Install (enbNodes1.Get(2));
-	
-	
-	
-	
-	Ptr<ListPositionAllocator> positionAlloc2One = CreateObject<ListPositionAllocator> ();
-	positionAlloc2One->Add (Vector(-331.1, 697.34, 23.0));
-	MobilityHelper mobilityENB2One;
-	mobilityENB2One.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB2One.SetPositionAllocator (positionAlloc2One);
-	mobilityENB2One.Install (enbNodes1.Get(3));
-	
-	Ptr<ListPositionAllocator> positionAlloc2Two = CreateObject<ListPositionAllocator> ();
-	positionAlloc2Two->Add (Vector(-332.0, 698.0, 23.0));
-	MobilityHelper mobilityENB2Two;
-	mobilityENB2Two.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB2Two.SetPositionAllocator (positionAlloc2Two);
-	mobilityENB2Two.Install (enbNodes1.Get(4));
-	
-	Ptr<ListPositionAllocator> positionAlloc2Three = CreateObject<ListPositionAllocator> ();
-	positionAlloc2Three->Add (Vector(-332.76, 696.35, 23.0));
-	MobilityHelper mobilityENB2Three;
-	mobilityENB2Three.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB2Three.SetPositionAllocator (positionAlloc2Three);
-	mobilityENB2Three.Install (enbNodes1.Get(5));
-	
-	
-	
-	
-	Ptr<ListPositionAllocator> positionAlloc3One = CreateObject<ListPositionAllocator> ();
-	positionAlloc3One->Add (Vector(-677.5, -769.13, 23.0));
-	MobilityHelper mobilityENB3One;
-	mobilityENB3One.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB3One.SetPositionAllocator (positionAlloc3One);
-	mobilityENB3One.Install (enbNodes1.Get(6));
-	
-	Ptr<ListPositionAllocator> positionAlloc3Two = CreateObject<ListPositionAllocator> ();
-	positionAlloc3Two->Add (Vector(-679.0, -770.0, 23.0));
-	MobilityHelper mobilityENB3Two;
-	mobilityENB3Two.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB3Two.SetPositionAllocator (positionAlloc3Two);
-	mobilityENB3Two.Install (enbNodes1.Get(7));
-	
-	Ptr<ListPositionAllocator> positionAlloc3Three = CreateObject<ListPositionAllocator> ();
-	positionAlloc3Three->Add (Vector(-677.5, -770.86, 23.0));
-	MobilityHelper mobilityENB3Three;
-	mobilityENB3Three.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB3Three.SetPositionAllocator (positionAlloc3Three);
-	mobilityENB3Three.Install (enbNodes1.Get(8));
-	
-	
-	
-	
-	Ptr<ListPositionAllocator> positionAlloc4One = CreateObject<ListPositionAllocator> ();
-	positionAlloc4One->Add (Vector(570.98, -377.17, 23.0));
-	MobilityHelper mobilityENB4One;
-	mobilityENB4One.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB4One.SetPositionAllocator (positionAlloc4One);
-	mobilityENB4One.Install (enbNodes1.Get(9));
-	
-	Ptr<ListPositionAllocator> positionAlloc4Two = CreateObject<ListPositionAllocator> ();
-	positionAlloc4Two->Add (Vector(569.1, -376.5, 23.0));
-	MobilityHelper mobilityENB4Two;
-	mobilityENB4Two.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB4Two.SetPositionAllocator (positionAlloc4Two);
-	mobilityENB4Two.Install (enbNodes1.Get(10));
-	
-	Ptr<ListPositionAllocator> positionAlloc4Three = CreateObject<ListPositionAllocator> ();
-	positionAlloc4Three->Add (Vector(569.83, -377.98, 23.0));
-	MobilityHelper mobilityENB4Three;
-	mobilityENB4Three.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB4Three.SetPositionAllocator (positionAlloc4Three);
-	mobilityENB4Three.Install (enbNodes1.Get(11));
-	
-	
-	
-	
-	Ptr<ListPositionAllocator> positionAlloc5One = CreateObject<ListPositionAllocator> ();
-	positionAlloc5One->Add (Vector(-1066.66, -79.1, 23.0));
-	MobilityHelper mobilityENB5One;
-	mobilityENB5One.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB5One.SetPositionAllocator (positionAlloc5One);
-	mobilityENB5One.Install (enbNodes1.Get(12));
-	
-	Ptr<ListPositionAllocator> positionAlloc5Two = CreateObject<ListPositionAllocator> ();
-	positionAlloc5Two->Add (Vector(-1067.98, -79.83, 23.0));
-	MobilityHelper mobilityENB5Two;
-	mobilityENB5Two.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB5Two.SetPositionAllocator (positionAlloc5Two);
-	mobilityENB5Two.Install (enbNodes1.Get(13));
-	
-	Ptr<ListPositionAllocator> positionAlloc5Three = CreateObject<ListPositionAllocator> ();
-	positionAlloc5Three->Add (Vector(-1066.35, -80.77, 23.0));
-	MobilityHelper mobilityENB5Three;
-	mobilityENB5Three.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityENB5Three.SetPositionAllocator (positionAlloc5Three);
-	mobilityENB5Three.Install (enbNodes1.Get(14));
-
-
+	// eNB mobility, one position allocator per tier
 
+	InstallCellMobility (cells, enbNodes1, enbNodes2);
 
-	//mobility of small cells
 
-	Ptr<ListPositionAllocator> positionAlloc1Onee = CreateObject<ListPositionAllocator> ();
-	positionAlloc1Onee->Add (Vector(-600.1, 200.2, 0.1));
-	MobilityHelper mobilityOne;
-	mobilityOne.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityOne.SetPositionAllocator (positionAlloc1Onee);
-	mobilityOne.Install (enbNodes2.Get(0));
-	
-	Ptr<ListPositionAllocator> positionAlloc1Twoo = CreateObject<ListPositionAllocator> ();
-	positionAlloc1Twoo->Add (Vector(-1000, 700, 0.1));
-	MobilityHelper mobilityTwo;
-	mobilityTwo.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityTwo.SetPositionAllocator (positionAlloc1Twoo);
-	mobilityTwo.Install (enbNodes2.Get(1));
-	
-	Ptr<ListPositionAllocator> positionAlloc1Threee = CreateObject<ListPositionAllocator> ();
-	positionAlloc1Threee->Add (Vector(600.3, 600.3, 0.1));
-	MobilityHelper mobilityThree;
-	mobilityThree.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityThree.SetPositionAllocator (positionAlloc1Threee);
-	mobilityThree.Install (enbNodes2.Get(2));
-	
-	Ptr<ListPositionAllocator> positionAlloc2Onee = CreateObject<ListPositionAllocator> ();
-	positionAlloc2Onee->Add (Vector(-750.2, 600, 0.1));
-	MobilityHelper mobilityFour;
-	mobilityFour.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityFour.SetPositionAllocator (positionAlloc2Onee);
-	mobilityFour.Install (enbNodes2.Get(3));
-	
-	Ptr<ListPositionAllocator> positionAlloc2Twoo = CreateObject<ListPositionAllocator> ();
-	positionAlloc2Twoo->Add (Vector(-1100.3, -750.1, 0.1));
-	MobilityHelper mobilityFive;
-	mobilityFive.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityFive.SetPositionAllocator (positionAlloc2Twoo);
-	mobilityFive.Install (enbNodes2.Get(4));
-	
-	Ptr<ListPositionAllocator> positionAlloc2Threee = CreateObject<ListPositionAllocator> ();
-	positionAlloc2Threee->Add (Vector(-450.2, -100, 0.1));
-	MobilityHelper mobilitySix;
-	mobilitySix.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilitySix.SetPositionAllocator (positionAlloc2Threee);
-	mobilitySix.Install (enbNodes2.Get(5));
-	
-	Ptr<ListPositionAllocator> positionAlloc3Onee = CreateObject<ListPositionAllocator> ();
-	positionAlloc3Onee->Add (Vector(650.5, 100.2, 0.1));
-	MobilityHelper mobilitySeven;
-	mobilitySeven.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilitySeven.SetPositionAllocator (positionAlloc3Onee);
-	mobilitySeven.Install (enbNodes2.Get(6));
-	
-	Ptr<ListPositionAllocator> positionAlloc3Twoo = CreateObject<ListPositionAllocator> ();
-	positionAlloc3Twoo->Add (Vector(-1000.2, -500.1, 0.1));
-	MobilityHelper mobilityEight;
-	mobilityEight.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityEight.SetPositionAllocator (positionAlloc3Twoo);
-	mobilityEight.Install (enbNodes2.Get(7));
-	
-	Ptr<ListPositionAllocator> positionAlloc3Threee= CreateObject<ListPositionAllocator> ();
-	positionAlloc3Threee->Add (Vector(200.5, -800.1, 0.1));
-	MobilityHelper mobilityNine;
-	mobilityNine.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityNine.SetPositionAllocator (positionAlloc3Threee);
-	mobilityNine.Install (enbNodes2.Get(8));
-
-	Ptr<ListPositionAllocator> positionAlloc4Onee = CreateObject<ListPositionAllocator> ();
-	positionAlloc4Onee->Add (Vector(-200, -750.1,0.1));
-	MobilityHelper mobilityTen;
-	mobilityTen.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityTen.SetPositionAllocator (positionAlloc4Onee);
-	mobilityTen.Install (enbNodes2.Get(9));
-	
-	Ptr<ListPositionAllocator> positionAlloc4Twoo = CreateObject<ListPositionAllocator> ();
-	positionAlloc4Twoo->Add (Vector(300.4, 780.2,0.1));
-	MobilityHelper mobilityEleven;
-	mobilityEleven.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityEleven.SetPositionAllocator (positionAlloc4Twoo);
-	mobilityEleven.Install (enbNodes2.Get(10));
-	
-	Ptr<ListPositionAllocator> positionAlloc4Threee = CreateObject<ListPositionAllocator> ();
-	positionAlloc4Threee->Add (Vector(0.2, 500.5, 0.1));
-	MobilityHelper mobilityTwelve;
-	mobilityTwelve.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityTwelve.SetPositionAllocator (positionAlloc4Threee);
-	mobilityTwelve.Install (enbNodes2.Get(11));
-	
-	Ptr<ListPositionAllocator> positionAlloc5Onee = CreateObject<ListPositionAllocator> ();
-	positionAlloc5Onee->Add (Vector(-1100.3, 400.8, 0.1));
-	MobilityHelper mobilityThirteen;
-	mobilityThirteen.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityThirteen.SetPositionAllocator (positionAlloc5Onee);
-	mobilityThirteen.Install (enbNodes2.Get(12));
-	
-	Ptr<ListPositionAllocator> positionAlloc5Twoo = CreateObject<ListPositionAllocator> ();
-	positionAlloc5Twoo->Add (Vector(600.5, -800.6, 0.1));
-	MobilityHelper mobilityFourteen;
-	mobilityFourteen.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityFourteen.SetPositionAllocator (positionAlloc5Twoo);
-	mobilityFourteen.Install (enbNodes2.Get(13));
-	
-	Ptr<ListPositionAllocator> positionAlloc5Threee = CreateObject<ListPositionAllocator> ();
-	positionAlloc5Threee->Add (Vector(0.7, -450, 0.1));
-	MobilityHelper mobilityFifteen;
-	mobilityFifteen.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-	mobilityFifteen.SetPositionAllocator (positionAlloc5Threee);
-	mobilityFifteen.Install (enbNodes2.Get(14));
+//NOW THE UEs
 
 
 
-//NOW THE UEs
+	// One position allocator per class, all over the same area
 
+	std::vector<MobilityHelper> mobilityByClass (mix.size ());
+	for (uint32_t c = 0; c < mix.size (); ++c)
+	{
+		mobilityByClass[c].SetMobilityModel ("ns3::ConstantPositionMobilityModel");
+ 		mobilityByClass[c].SetPositionAllocator ("ns3::RandomBoxPositionAllocator",
+			"X",StringValue ("ns3::UniformRandomVariable[Min=-1200.0|Max=800.0]"),
+			"Y",StringValue ("ns3::UniformRandomVariable[Min=-900.0|Max=800.0]"),
+			"Z",StringValue ("ns3::UniformRandomVariable[Min=1.0|Max=1.0]"));
+	}
+	for (uint32_t c = 0; c < mix.size (); ++c)
+  		mobilityByClass[c].Install (ueNodesByClass[c]);
 
+	// Grid index per tier for the nearest-cell queries of the attach step
 
-	MobilityHelper mobilityUEOne;
-	mobilityUEOne.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
- 	mobilityUEOne.SetPositionAllocator ("ns3::RandomBoxPositionAllocator",
-		"X",StringValue ("ns3::UniformRandomVariable[Min=-1200.0|Max=800.0]"),
-		"Y",StringValue ("ns3::UniformRandomVariable[Min=-900.0|Max=800.0]"),
-		"Z",StringValue ("ns3::UniformRandomVariable[Min=1.0|Max=1.0]"));
+	CellGridIndex macroIndex (enbNodes1);
+	CellGridIndex smallIndex (enbNodes2);
 
-	MobilityHelper mobilityUETwo;
-	mobilityUETwo.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
- 	mobilityUETwo.SetPositionAllocator ("ns3::RandomBoxPositionAllocator",
-		"X",StringValue ("ns3::UniformRandomVariable[Min=-1200.0|Max=800.0]"),
-		"Y",StringValue ("ns3::UniformRandomVariable[Min=-900.0|Max=800.0]"),
-		"Z",StringValue ("ns3::UniformRandomVariable[Min=1.0|Max=1.0]"));
+	// Partitioned run: the tiers use disjoint DL and UL carriers and exchange
+	// no traffic (the EPC and remote host only relay each UE's own flows), so
+	// each tier runs in its own process with its cells and the UEs it serves,
+	// from the same layout and UE positions. The parent merges their KPIs.
+	uint32_t onlyTier = 0;
+	if (partitionTiers)
+	{
+		NS_ABORT_MSG_UNLESS (fanOut.empty (), "partitionTiers cannot be combined with fanOut");
+		NS_ABORT_MSG_IF (TiersShareCarrier (cells), "partitionTiers needs the tiers on different DL and UL EARFCNs, "
+		                 "or their interference would be lost");
+		NS_ABORT_MSG_IF (traceFormat == "text" && (traces.find ("phy") != std::string::npos || traces.find ("mac") != std::string::npos),
+		                 "Text PHY/MAC traces cannot be split per tier, use the columnar format");
+		uint32_t failed = 0;
+		int partition = ForkVariants (2, sweepJobs, failed);
+		if (partition < 0)
+		{
+			ProfilingSimulatorImpl::SetReportName ("");
+			if (!kpiFile.empty () && failed == 0)
+				MergeTierKpis (kpiFile, tag.str (), std::chrono::duration<double> (std::chrono::steady_clock::now () - wallStart).count ());
+			Simulator::Destroy ();
+			return failed > 0;
+		}
 
-	MobilityHelper mobilityUEThree;
-	mobilityUEThree.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
- 	mobilityUEThree.SetPositionAllocator ("ns3::RandomBoxPositionAllocator",
-		"X",StringValue ("ns3::UniformRandomVariable[Min=-1200.0|Max=800.0]"),
-		"Y",StringValue ("ns3::UniformRandomVariable[Min=-900.0|Max=800.0]"),
-		"Z",StringValue ("ns3::UniformRandomVariable[Min=1.0|Max=1.0]"));
-	
-  	mobilityUEOne.Install (ueNodesOne);
-  	mobilityUETwo.Install (ueNodesTwo);	
-  	mobilityUEThree.Install (ueNodesThree);
-
-  	Ptr<MobilityModel> modelENB1 = enbNodes1.Get(0)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB2 = enbNodes1.Get(1)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB3 = enbNodes1.Get(2)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB4 = enbNodes1.Get(3)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB5 = enbNodes1.Get(4)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB6 = enbNodes1.Get(5)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB7 = enbNodes1.Get(6)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB8 = enbNodes1.Get(7)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB9 = enbNodes1.Get(8)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB10 = enbNodes1.Get(9)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB11 = enbNodes1.Get(10)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB12 = enbNodes1.Get(11)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB13 = enbNodes1.Get(12)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB14 = enbNodes1.Get(13)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB15 = enbNodes1.Get(14)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB16 = enbNodes2.Get(0)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB17 = enbNodes2.Get(1)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB18 = enbNodes2.Get(2)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB19 = enbNodes2.Get(3)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB20 = enbNodes2.Get(4)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB21 = enbNodes2.Get(5)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB22 = enbNodes2.Get(6)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB23 = enbNodes2.Get(7)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB24 = enbNodes2.Get(8)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB25 = enbNodes2.Get(9)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB26 = enbNodes2.Get(10)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB27 = enbNodes2.Get(11)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB28 = enbNodes2.Get(12)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB29 = enbNodes2.Get(13)->GetObject<MobilityModel>();
-	Ptr<MobilityModel> modelENB30 = enbNodes2.Get(14)->GetObject<MobilityModel>();
+		onlyTier = partition + 1;
+		for (uint32_t c = 0; c < mix.size (); ++c)
+			ueNodesByClass[c] = UesOfTier (ueNodesByClass[c], macroIndex, smallIndex, smallCellRange, onlyTier == 2);
+		tag << "_tier" << onlyTier;
+		traceRecorder.SetTag (tag.str ());
+		ProfilingSimulatorImpl::SetReportName ("EventProfile" + tag.str ());
+		if (!kpiFile.empty ())
+			kpiFile += tag.str ();
+		if (!ulStatsFile.empty ())
+			ulStatsFile += tag.str ();
+		if (!provisioningLog.empty ())
+			provisioningLog += tag.str ();
+	}
 	
 	
         //lteHelper->SetPathlossModelAttribute ("Environment", EnumValue (Urban));
@@ -425,1251 +1190,289 @@ int main (int argc, char *argv[])
   	NetDeviceContainer enbDevs2;
 
 
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (10));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (20.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (0)));
-
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (120));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (15.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));	
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (1)));
-  	
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (280));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (20.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (2)));
-
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (350));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (20.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (3)));
-
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (90));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (15.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (4)));
-
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (220));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (15.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (5)));
-
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (15.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (6)));
-
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (180));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (15.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (7)));
-
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (300));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (15.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (8)));
-
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (350));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (15.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (9)));
-
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (150));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (15.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (10)));
-
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (220));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (15.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (11)));
-
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (10));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (20.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (12)));
-
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (140));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (15.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (13)));
-
-  	lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
- 	lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (300));
-  	lteHelper->SetEnbAntennaModelAttribute ("Beamwidth",   DoubleValue (60));
-  	lteHelper->SetEnbAntennaModelAttribute ("MaxGain",     DoubleValue (15.0));
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (24300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuR1411NlosOverRooftopPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (800e6));
-	lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (15.0));
-	enbDevs.Add ( lteHelper->InstallEnbDevice (enbNodes1.Get (14)));
-
-//Here the isotropics
-
-	Config::SetDefault ("ns3::LteEnbPhy::TxPower", DoubleValue (23.0)); // change the power to small cells
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (0)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (1)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (2)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (3)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (4)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (5)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (6)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (7)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (8)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (9)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (10)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (11)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (12)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (13)));
-
-	lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::ItuInhPropagationLossModel"));
-	lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (2100e6));
-	lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
-	lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (18300));
-  	lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (12));
-	enbDevs2.Add ( lteHelper->InstallEnbDevice (enbNodes2.Get (14)));
+	phases.Mark ("enbInstall");
+
+	// One attribute pass per distinct cell profile (tier, antenna, power, carrier)
+
+	NodeContainer allUes;
+	for (uint32_t c = 0; c < mix.size (); ++c)
+		allUes.Add (ueNodesByClass[c]);
+	if (couplingLossCache)
+		g_couplingLossTable = new CouplingLossTable (cells, enbNodes1, enbNodes2, allUes, antennaLut);
+
+	// Receiver culling: the channels skip any receiver beyond this coupling
+	// loss, including those of other carriers once the UEs are attached
+
+	double cullingMaxLoss = 0;
+	if (receiverCulling)
+	{
+		NS_ABORT_MSG_UNLESS (couplingLossCache, "receiverCulling needs the coupling loss cache");
+		cullingMaxLoss = CullingMaxLossDb (cells, cullMargin);
+		lteHelper->SetSpectrumChannelAttribute ("MaxLossDb", DoubleValue (cullingMaxLoss));
+	}
+	InstallCellDevices (lteHelper, cells, enbNodes1, enbNodes2, enbDevs, enbDevs2, couplingLossCache, antennaLut, onlyTier);
 
 
   	
   	  	
-  	NetDeviceContainer ueDevsOne = lteHelper->InstallUeDevice (ueNodesOne);
-	NetDeviceContainer ueDevsTwo = lteHelper->InstallUeDevice (ueNodesTwo);
-  	NetDeviceContainer ueDevsThree = lteHelper->InstallUeDevice (ueNodesThree);	
+	// Per-UE footprint by component: heap growth of each install step
+
+	phases.Mark ("ueInstall");
+	size_t heapBefore = HeapInUse ();
+	std::vector<NetDeviceContainer> ueDevsByClass;
+	for (uint32_t c = 0; c < mix.size (); ++c)
+  		ueDevsByClass.push_back (lteHelper->InstallUeDevice (ueNodesByClass[c]));
+	size_t heapLteDevice = HeapInUse ();
 	
-	// Install the IP stack on the UEs
+	// Install the IP stack on the UEs. The static stack has IPv4 only and
+	// routes with static routing alone (no list/global routing per UE).
 
-  	internet.Install (ueNodesOne);
-  	internet.Install (ueNodesTwo);
-  	internet.Install (ueNodesThree);  	
-  	Ipv4InterfaceContainer ueIpIfaceOne;
-  	Ipv4InterfaceContainer ueIpIfaceTwo;
-  	Ipv4InterfaceContainer ueIpIfaceThree;
-  	ueIpIfaceOne = epcHelper->AssignUeIpv4Address (NetDeviceContainer (ueDevsOne));
-  	ueIpIfaceTwo = epcHelper->AssignUeIpv4Address (NetDeviceContainer (ueDevsTwo));
-  	ueIpIfaceThree = epcHelper->AssignUeIpv4Address (NetDeviceContainer (ueDevsThree));
+	phases.Mark ("ipAssignment");
+	InternetStackHelper ueInternet;
+	if (staticUeStack)
+	{
+		ueInternet.SetIpv6StackInstall (false);
+		ueInternet.SetRoutingHelper (ipv4RoutingHelper);
+	}
+  	ueInternet.Install (allUes);
+	std::vector<Ipv4InterfaceContainer> ueIpIfaceByClass;
+	for (uint32_t c = 0; c < mix.size (); ++c)
+  		ueIpIfaceByClass.push_back (epcHelper->AssignUeIpv4Address (ueDevsByClass[c]));
+	size_t heapIpStack = HeapInUse ();
 
-  	// Assign IP address to UEs, and install applications
+  	// Set the default gateway of every UE
 
-  	for (uint32_t u = 0; u < ueNodesOne.GetN (); ++u)
+	Ipv4Address ueGateway = epcHelper->GetUeDefaultGatewayAddress ();
+  	for (uint32_t u = 0; u < allUes.GetN (); ++u)
    	 {
-	     	 Ptr<Node> ueNodeOne = ueNodesOne.Get (u);
-
-	      	// Set the default gateway for the UE
-
-	      	Ptr<Ipv4StaticRouting> ueStaticRouting = ipv4RoutingHelper.GetStaticRouting (ueNodeOne->GetObject<Ipv4> ());
-	      	ueStaticRouting->SetDefaultRoute (epcHelper->GetUeDefaultGatewayAddress (), 1);
+	      	Ptr<Ipv4StaticRouting> ueStaticRouting = ipv4RoutingHelper.GetStaticRouting (allUes.Get (u)->GetObject<Ipv4> ());
+	      	ueStaticRouting->SetDefaultRoute (ueGateway, 1);
     	}
-	
-	for (uint32_t u = 0; u < ueNodesTwo.GetN (); ++u)
-   	 {
-	     	 Ptr<Node> ueNodeTwo = ueNodesTwo.Get (u);
-
-	      	// Set the default gateway for the UE
+	size_t heapRouting = HeapInUse ();
 
-	      	Ptr<Ipv4StaticRouting> ueStaticRouting = ipv4RoutingHelper.GetStaticRouting (ueNodeTwo->GetObject<Ipv4> ());
-	      	ueStaticRouting->SetDefaultRoute (epcHelper->GetUeDefaultGatewayAddress (), 1);
-    	}
-	
-	for (uint32_t u = 0; u < ueNodesThree.GetN (); ++u)
-   	 {
-	     	 Ptr<Node> ueNodeThree = ueNodesThree.Get (u);
+	phases.Mark ("association");
 
-	      	// Set the default gateway for the UE
+	// Attach every UE in one ordered batch. Serving cells are computed once by a
+	// pool of worker threads and reused by the traffic setup below.
 
-	      	Ptr<Ipv4StaticRouting> ueStaticRouting = ipv4RoutingHelper.GetStaticRouting (ueNodeThree->GetObject<Ipv4> ());
-	      	ueStaticRouting->SetDefaultRoute (epcHelper->GetUeDefaultGatewayAddress (), 1);
-    	}
+	std::vector<std::vector<UeAssociation> > associations = BulkAttach (lteHelper, ueDevsByClass, enbDevs, enbDevs2,
+	                                                                     macroIndex, smallIndex, smallCellRange, attachThreads);
+	if (receiverCulling)
+		CullReceivers (*g_couplingLossTable, cullingMaxLoss, "CullingReport" + tag.str () + ".csv", cells,
+		               enbNodes1, enbNodes2, ueDevsByClass, associations);
 
-	// Attach one UE per eNodeB
-	
-	for (uint32_t u = 0; u < ueNodesOne.GetN (); ++u) 	 
+	// The NB-IoT scheduler repeats per CE level, which is known per IMSI; it
+	// reaches the serving cell's scheduler once the UE has an RNTI there
+	CeLevelNotifier ceNotifier;
+	if (nbiotScheduler)
 	{
-		Ptr<MobilityModel> modelNodeOne = ueNodesOne.Get(u)->GetObject<MobilityModel>();
-		double distance1 = modelNodeOne->GetDistanceFrom(modelENB1);
-		double distance2 = modelNodeOne->GetDistanceFrom(modelENB2);
-		double distance3 = modelNodeOne->GetDistanceFrom(modelENB3);
-		double distance4 = modelNodeOne->GetDistanceFrom(modelENB4);
-		double distance5 = modelNodeOne->GetDistanceFrom(modelENB5);
-		double distance6 = modelNodeOne->GetDistanceFrom(modelENB6);
-		double distance7 = modelNodeOne->GetDistanceFrom(modelENB7);
-		double distance8 = modelNodeOne->GetDistanceFrom(modelENB8);
-		double distance9 = modelNodeOne->GetDistanceFrom(modelENB9);
-		double distance10 = modelNodeOne->GetDistanceFrom(modelENB10);
-		double distance11 = modelNodeOne->GetDistanceFrom(modelENB11);
-		double distance12 = modelNodeOne->GetDistanceFrom(modelENB12);
-		double distance13 = modelNodeOne->GetDistanceFrom(modelENB13);
-		double distance14 = modelNodeOne->GetDistanceFrom(modelENB14);
-		double distance15 = modelNodeOne->GetDistanceFrom(modelENB15);
-		double distance16 = modelNodeOne->GetDistanceFrom(modelENB16);
-		double distance17 = modelNodeOne->GetDistanceFrom(modelENB17);
-		double distance18 = modelNodeOne->GetDistanceFrom(modelENB18);
-		double distance19 = modelNodeOne->GetDistanceFrom(modelENB19);
-		double distance20 = modelNodeOne->GetDistanceFrom(modelENB20);
-		double distance21 = modelNodeOne->GetDistanceFrom(modelENB21);
-		double distance22 = modelNodeOne->GetDistanceFrom(modelENB22);
-		double distance23 = modelNodeOne->GetDistanceFrom(modelENB23);
-		double distance24 = modelNodeOne->GetDistanceFrom(modelENB24);
-		double distance25 = modelNodeOne->GetDistanceFrom(modelENB25);
-		double distance26 = modelNodeOne->GetDistanceFrom(modelENB26);
-		double distance27 = modelNodeOne->GetDistanceFrom(modelENB27);
-		double distance28 = modelNodeOne->GetDistanceFrom(modelENB28);
-		double distance29 = modelNodeOne->GetDistanceFrom(modelENB29);
-		double distance30 = modelNodeOne->GetDistanceFrom(modelENB30);
-		
-		double distancearray1[] = {distance1, distance2, distance3, distance4, distance5, distance6,  // distance to macro
-		distance7, distance8, distance9, distance10, distance11, distance12, distance13, distance14,
-		distance15};
-		double distancearray2[] = {distance16, distance17, distance18, distance19, distance20, distance21, distance22,
-		distance23, distance24, distance25, distance26, distance27, distance28, distance29, distance30};
-
-		double dist1 = distancearray1[0];
-		double dist2 = distancearray2[0]; 
-
-		for ( int i = 0; i <= 14; i++ )
-        		{
-        		if ( distancearray1[i] < dist1 ){
-            		dist1 = distancearray1[i];
-			}
-		}
-
-		for ( int i = 0; i <= 14; i++ )
-        		{
-        		if ( distancearray2[i] < dist2 ){
-            		dist2 = distancearray2[i];
-			}
-		}
-		
-		std::cout <<"dist1: "<<dist1<<", y dist2: "<<dist2<<std::endl;
-		if (dist2 < dist1)
-		{
-			if(dist2<150)
-			{
-				lteHelper->AttachToClosestEnb (ueDevsOne.Get(u), enbDevs2);
-			std::cout << "Indoor closest and in range"<<std::endl;
-			}
-			else
-			{
-				lteHelper->AttachToClosestEnb (ueDevsOne.Get(u), enbDevs);
-			std::cout << "Outdoor, closer to Indoor but not enough"<<std::endl;
-			}			
-		}
-      		else
-      		{
-      		lteHelper->AttachToClosestEnb (ueDevsOne.Get(u), enbDevs);
-		std::cout << "Outdoor closest"<<std::endl;
-      		}
-
+		ceNotifier.AddCells (enbDevs);
+		ceNotifier.AddCells (enbDevs2);
+		Config::ConnectWithoutContext ("/NodeList/*/DeviceList/*/LteUeRrc/ConnectionEstablished",
+		                               MakeCallback (&CeLevelNotifier::ConnectionEstablished, &ceNotifier));
+		Config::ConnectWithoutContext ("/NodeList/*/DeviceList/*/LteUeRrc/HandoverEndOk",
+		                               MakeCallback (&CeLevelNotifier::ConnectionEstablished, &ceNotifier));
 	}
-for (uint32_t v = 0; v < ueNodesTwo.GetN (); ++v) 	 
-	{
-		Ptr<MobilityModel> modelNodeOne = ueNodesTwo.Get(v)->GetObject<MobilityModel>();
-		double distance1 = modelNodeOne->GetDistanceFrom(modelENB1);
-		double distance2 = modelNodeOne->GetDistanceFrom(modelENB2);
-		double distance3 = modelNodeOne->GetDistanceFrom(modelENB3);
-		double distance4 = modelNodeOne->GetDistanceFrom(modelENB4);
-		double distance5 = modelNodeOne->GetDistanceFrom(modelENB5);
-		double distance6 = modelNodeOne->GetDistanceFrom(modelENB6);
-		double distance7 = modelNodeOne->GetDistanceFrom(modelENB7);
-		double distance8 = modelNodeOne->GetDistanceFrom(modelENB8);
-		double distance9 = modelNodeOne->GetDistanceFrom(modelENB9);
-		double distance10 = modelNodeOne->GetDistanceFrom(modelENB10);
-		double distance11 = modelNodeOne->GetDistanceFrom(modelENB11);
-		double distance12 = modelNodeOne->GetDistanceFrom(modelENB12);
-		double distance13 = modelNodeOne->GetDistanceFrom(modelENB13);
-		double distance14 = modelNodeOne->GetDistanceFrom(modelENB14);
-		double distance15 = modelNodeOne->GetDistanceFrom(modelENB15);
-		double distance16 = modelNodeOne->GetDistanceFrom(modelENB16);
-		double distance17 = modelNodeOne->GetDistanceFrom(modelENB17);
-		double distance18 = modelNodeOne->GetDistanceFrom(modelENB18);
-		double distance19 = modelNodeOne->GetDistanceFrom(modelENB19);
-		double distance20 = modelNodeOne->GetDistanceFrom(modelENB20);
-		double distance21 = modelNodeOne->GetDistanceFrom(modelENB21);
-		double distance22 = modelNodeOne->GetDistanceFrom(modelENB22);
-		double distance23 = modelNodeOne->GetDistanceFrom(modelENB23);
-		double distance24 = modelNodeOne->GetDistanceFrom(modelENB24);
-		double distance25 = modelNodeOne->GetDistanceFrom(modelENB25);
-		double distance26 = modelNodeOne->GetDistanceFrom(modelENB26);
-		double distance27 = modelNodeOne->GetDistanceFrom(modelENB27);
-		double distance28 = modelNodeOne->GetDistanceFrom(modelENB28);
-		double distance29 = modelNodeOne->GetDistanceFrom(modelENB29);
-		double distance30 = modelNodeOne->GetDistanceFrom(modelENB30);
-		
-		double distancearray1[] = {distance1, distance2, distance3, distance4, distance5, distance6,
-		distance7, distance8, distance9, distance10, distance11, distance12, distance13, distance14,
-		distance15};
-		double distancearray2[] = {distance16, distance17, distance18, distance19, distance20, distance21, distance22,
-		distance23, distance24, distance25, distance26, distance27, distance28, distance29, distance30};
-
-		double dist1 = distancearray1[0];
-		double dist2 = distancearray2[0]; 
-
-		for ( int i = 0; i <= 14; i++ )
-        		{
-        		if ( distancearray1[i] < dist1 ){
-            		dist1 = distancearray1[i];
-			}
-		}
 
-		for ( int i = 0; i <= 14; i++ )
-        		{
-        		if ( distancearray2[i] < dist2 ){
-            		dist2 = distancearray2[i];
-			}
-		}
-		
-		std::cout <<"dist1: "<<dist1<<", y dist2: "<<dist2<<std::endl;
-		if (dist2 < dist1)
-		{
-			if(dist2<150)
-			{
-				lteHelper->AttachToClosestEnb (ueDevsTwo.Get(v), enbDevs2);
-			std::cout << "Indoor closest and in range"<<std::endl;
-			}
-			else
-			{
-				lteHelper->AttachToClosestEnb (ueDevsTwo.Get(v), enbDevs);
-			std::cout << "Outdoor, closer to Indoor but not enough"<<std::endl;
-			}			
-		}
-      		else
-      		{
-      		lteHelper->AttachToClosestEnb (ueDevsTwo.Get(v), enbDevs);
-		std::cout << "Outdoor closest"<<std::endl;
-      		}
 
-	}
+	// Warm start: the network is built and attached once, the RRC connections
+	// are set up during the warm-up, then every fan-out variant continues in a
+	// copy-on-write child with its own traffic options (re-parsed over the
+	// command line) and output tag. Traffic and traces start after warm-up.
 
-	for (uint32_t w = 0; w < ueNodesThree.GetN (); ++w) 	 
+	if (warmUp > 0)
 	{
-		Ptr<MobilityModel> modelNodeOne = ueNodesThree.Get(w)->GetObject<MobilityModel>();
-		double distance1 = modelNodeOne->GetDistanceFrom(modelENB1);
-		double distance2 = modelNodeOne->GetDistanceFrom(modelENB2);
-		double distance3 = modelNodeOne->GetDistanceFrom(modelENB3);
-		double distance4 = modelNodeOne->GetDistanceFrom(modelENB4);
-		double distance5 = modelNodeOne->GetDistanceFrom(modelENB5);
-		double distance6 = modelNodeOne->GetDistanceFrom(modelENB6);
-		double distance7 = modelNodeOne->GetDistanceFrom(modelENB7);
-		double distance8 = modelNodeOne->GetDistanceFrom(modelENB8);
-		double distance9 = modelNodeOne->GetDistanceFrom(modelENB9);
-		double distance10 = modelNodeOne->GetDistanceFrom(modelENB10);
-		double distance11 = modelNodeOne->GetDistanceFrom(modelENB11);
-		double distance12 = modelNodeOne->GetDistanceFrom(modelENB12);
-		double distance13 = modelNodeOne->GetDistanceFrom(modelENB13);
-		double distance14 = modelNodeOne->GetDistanceFrom(modelENB14);
-		double distance15 = modelNodeOne->GetDistanceFrom(modelENB15);
-		double distance16 = modelNodeOne->GetDistanceFrom(modelENB16);
-		double distance17 = modelNodeOne->GetDistanceFrom(modelENB17);
-		double distance18 = modelNodeOne->GetDistanceFrom(modelENB18);
-		double distance19 = modelNodeOne->GetDistanceFrom(modelENB19);
-		double distance20 = modelNodeOne->GetDistanceFrom(modelENB20);
-		double distance21 = modelNodeOne->GetDistanceFrom(modelENB21);
-		double distance22 = modelNodeOne->GetDistanceFrom(modelENB22);
-		double distance23 = modelNodeOne->GetDistanceFrom(modelENB23);
-		double distance24 = modelNodeOne->GetDistanceFrom(modelENB24);
-		double distance25 = modelNodeOne->GetDistanceFrom(modelENB25);
-		double distance26 = modelNodeOne->GetDistanceFrom(modelENB26);
-		double distance27 = modelNodeOne->GetDistanceFrom(modelENB27);
-		double distance28 = modelNodeOne->GetDistanceFrom(modelENB28);
-		double distance29 = modelNodeOne->GetDistanceFrom(modelENB29);
-		double distance30 = modelNodeOne->GetDistanceFrom(modelENB30);
-		
-		double distancearray1[] = {distance1, distance2, distance3, distance4, distance5, distance6,
-		distance7, distance8, distance9, distance10, distance11, distance12, distance13, distance14,
-		distance15};
-		double distancearray2[] = {distance16, distance17, distance18, distance19, distance20, distance21, distance22,
-		distance23, distance24, distance25, distance26, distance27, distance28, distance29, distance30};
-
-		double dist1 = distancearray1[0];
-		double dist2 = distancearray2[0]; 
-
-		for ( int i = 0; i <= 14; i++ )
-        		{
-        		if ( distancearray1[i] < dist1 ){
-            		dist1 = distancearray1[i];
-			}
-		}
-
-		for ( int i = 0; i <= 14; i++ )
-        		{
-        		if ( distancearray2[i] < dist2 ){
-            		dist2 = distancearray2[i];
-			}
-		}
-		
-		std::cout <<"dist1: "<<dist1<<", y dist2: "<<dist2<<std::endl;
-		if (dist2 < dist1)
+		phases.Mark ("warmUp");
+		Simulator::Stop (Seconds (warmUp));
+		Simulator::Run ();
+	}
+	if (!fanOut.empty ())
+	{
+		NS_ABORT_MSG_IF (warmUp <= 0, "fanOut needs a warmUp time");
+		NS_ABORT_MSG_IF (traceFormat == "text" && (traces.find ("phy") != std::string::npos || traces.find ("mac") != std::string::npos),
+		                 "Text PHY/MAC traces cannot be split per fan-out variant, use the columnar format");
+		std::vector<std::string> variants;
+		std::replace (fanOut.begin (), fanOut.end (), '|', ' ');
+		std::istringstream variantList (fanOut);
+		std::copy (std::istream_iterator<std::string> (variantList), std::istream_iterator<std::string> (),
+		           std::back_inserter (variants));
+		uint32_t failed = 0;
+		int variant = ForkVariants (variants.size (), sweepJobs, failed);
+		if (variant < 0)
 		{
-			if(dist2<150)
-			{
-				lteHelper->AttachToClosestEnb (ueDevsThree.Get(w), enbDevs2);
-			std::cout << "Indoor closest and in range"<<std::endl;
-			}
-			else
-			{
-				lteHelper->AttachToClosestEnb (ueDevsThree.Get(w), enbDevs);
-			std::cout << "Outdoor, closer to Indoor but not enough"<<std::endl;
-			}			
+			// The variants report the warm-up events too
+			ProfilingSimulatorImpl::SetReportName ("");
+			Simulator::Destroy ();
+			return failed > 0;
 		}
-      		else
-      		{
-      		lteHelper->AttachToClosestEnb (ueDevsThree.Get(w), enbDevs);
-		std::cout << "Outdoor closest"<<std::endl;
-      		}
 
+		std::vector<std::string> options (1, argv[0]);
+		std::string spec = variants[variant];
+		std::replace (spec.begin (), spec.end (), ';', ' ');
+		std::istringstream optionList (spec);
+		std::string option;
+		while (optionList >> option)
+			options.push_back ("--" + option);
+		std::vector<char *> variantArgv;
+		for (uint32_t i = 0; i < options.size (); ++i)
+			variantArgv.push_back (const_cast<char *> (options[i].c_str ()));
+		cmd.Parse (variantArgv.size (), &variantArgv[0]);
+
+		// Variants may change the reports, not the UE groups built for the mix
+		double variantIntervals[] = {interPacketIntervalOne, interPacketIntervalTwo, interPacketIntervalThree};
+		std::string variantStarts[] = {startOne, startTwo, startThree};
+		std::vector<TrafficClass> variantMix = trafficMix.empty ()
+			? DefaultTrafficMix (variantIntervals, variantStarts, pacchetto) : LoadTrafficMix (trafficMix);
+		NS_ABORT_MSG_UNLESS (variantMix.size () == mix.size (), "A fan-out variant cannot change the traffic classes");
+		for (uint32_t c = 0; c < mix.size (); ++c)
+			NS_ABORT_MSG_UNLESS (variantMix[c].label == mix[c].label && variantMix[c].share == mix[c].share,
+			                     "A fan-out variant cannot change the traffic classes");
+		mix = variantMix;
+
+		tag << "_v" << variant;
+		traceRecorder.SetTag (tag.str ());
+		ProfilingSimulatorImpl::SetReportName ("EventProfile" + tag.str ());
+		if (!kpiFile.empty ())
+			kpiFile += tag.str ();
+		if (!ulStatsFile.empty ())
+			ulStatsFile += tag.str ();
+		if (!provisioningLog.empty ())
+			provisioningLog += tag.str ();
 	}
 
+	phases.Mark ("appInstall");
 
 	// randomize a bit start times to avoid simulation artifacts
 	// (e.g., buffer overflows due to packet transmissions happening
-  	// exactly at the same time) 
-  	Ptr<UniformRandomVariable> startTimeSecondsOne = CreateObject<UniformRandomVariable> ();
-  	startTimeSecondsOne->SetAttribute ("Min", DoubleValue (0));
-  	startTimeSecondsOne->SetAttribute ("Max", DoubleValue (interPacketIntervalOne/1000.0));
-  	//startTimeSecondsOne->SetAttribute ("Max", DoubleValue (simTime/2000));
-
-  	Ptr<UniformRandomVariable> startTimeSecondsTwo = CreateObject<UniformRandomVariable> ();
-  	startTimeSecondsTwo->SetAttribute ("Min", DoubleValue (0));
-  	startTimeSecondsTwo->SetAttribute ("Max", DoubleValue (interPacketIntervalOne/1000.0));
-  	//startTimeSecondsTwo->SetAttribute ("Max", DoubleValue (simTime/3000));
+  	// exactly at the same time). Every flow gets its own draw, over the
+	// longest period of the mix unless its class says otherwise.
+	double longestPeriod = 0;
+	for (uint32_t c = 0; c < mix.size (); ++c)
+		longestPeriod = std::max (longestPeriod, mix[c].period);
+	std::vector<StartTimeScheduler> startByClass;
+	for (uint32_t c = 0; c < mix.size (); ++c)
+		startByClass.push_back (StartTimeScheduler (mix[c].start, longestPeriod));
 
-  	Ptr<UniformRandomVariable> startTimeSecondsThree = CreateObject<UniformRandomVariable> ();
-  	startTimeSecondsThree->SetAttribute ("Min", DoubleValue (0));
-  	startTimeSecondsThree->SetAttribute ("Max", DoubleValue (interPacketIntervalOne/1000.0));
-  	//startTimeSecondsThree->SetAttribute ("Max", DoubleValue (simTime/4000));
 
-
-  	// Install and start applications on UEs and remote host
+  	// Install the traffic: DL sinks on the UEs, one timer wheel per class
   	
+	size_t heapApplications = HeapInUse ();
 	uint16_t dlPort = 1234;
   	uint16_t ulPort = 2000;
-	ApplicationContainer clientApps;
    	ApplicationContainer serverApps;
-	
-	for (uint32_t u = 0; u < ueNodesOne.GetN (); ++u) 	 
-	{
-      		++ulPort;		
-		PacketSinkHelper dlPacketSinkHelper ("ns3::UdpSocketFactory", InetSocketAddress (Ipv4Address::GetAny (), dlPort));
-     	 	PacketSinkHelper ulPacketSinkHelper ("ns3::UdpSocketFactory", InetSocketAddress (Ipv4Address::GetAny (), ulPort));
-		serverApps.Add (dlPacketSinkHelper.Install (ueNodesOne.Get(u)));
-      		serverApps.Add (ulPacketSinkHelper.Install (remoteHost));
-
 
-	
-		UdpClientHelper dlClientOne (ueIpIfaceOne.GetAddress (u), dlPort);
-      		//dlClientOne.SetAttribute ("Interval", TimeValue (Seconds(interPacketIntervalOne)));
-      		dlClientOne.SetAttribute ("Interval", TimeValue (MilliSeconds(interPacketIntervalOne)));
-      		dlClientOne.SetAttribute ("MaxPackets", UintegerValue(1000000));
-      		dlClientOne.SetAttribute ("PacketSize", UintegerValue(pacchetto));
-      		      		
-		UdpClientHelper ulClientOne (remoteHostAddr, ulPort);
-      		//ulClientOne.SetAttribute ("Interval", TimeValue (Seconds(interPacketIntervalOne)));
-      		ulClientOne.SetAttribute ("Interval", TimeValue (MilliSeconds(interPacketIntervalOne)));
-      		ulClientOne.SetAttribute ("MaxPackets", UintegerValue(1000000));
-		//ulClientOne.SetAttribute ("PacketSize", UintegerValue(pacchetto));
-
-		
-		Ptr<MobilityModel> modelNodeOne = ueNodesOne.Get(u)->GetObject<MobilityModel>();
-		double distance1 = modelNodeOne->GetDistanceFrom(modelENB1);
-		double distance2 = modelNodeOne->GetDistanceFrom(modelENB2);
-		double distance3 = modelNodeOne->GetDistanceFrom(modelENB3);
-		double distance4 = modelNodeOne->GetDistanceFrom(modelENB4);
-		double distance5 = modelNodeOne->GetDistanceFrom(modelENB5);
-		double distance6 = modelNodeOne->GetDistanceFrom(modelENB6);
-		double distance7 = modelNodeOne->GetDistanceFrom(modelENB7);
-		double distance8 = modelNodeOne->GetDistanceFrom(modelENB8);
-		double distance9 = modelNodeOne->GetDistanceFrom(modelENB9);
-		double distance10 = modelNodeOne->GetDistanceFrom(modelENB10);
-		double distance11 = modelNodeOne->GetDistanceFrom(modelENB11);
-		double distance12 = modelNodeOne->GetDistanceFrom(modelENB12);
-		double distance13 = modelNodeOne->GetDistanceFrom(modelENB13);
-		double distance14 = modelNodeOne->GetDistanceFrom(modelENB14);
-		double distance15 = modelNodeOne->GetDistanceFrom(modelENB15);
-		
-		double distancearray[] = {distance1, distance2, distance3, distance4, distance5, distance6, distance7, distance8, distance9, distance10, distance11, distance12, distance13, distance14, distance15};
-		
-
-    		double distance = 30000;
-                int imsi=0;
-
-    		for ( int i = 0; i <= 14; i++ )
-        		{
-        		if ( distancearray[i] < distance )
-            		distance = distancearray[i];
-			
-			}
-		imsi =ueDevsOne.Get(u)->GetObject<LteUeNetDevice>()->GetImsi();
-			std::cout<<imsi<<", ";
-
-		for ( int i = 0; i <= 14; i++ )
-        		{
-        		if ( distancearray[i] == distance )
-			std::cout<<i+1<<", ";
-			}
-		std::cout<<"A, ";
-		std::cout<<distance<<", ";
-		/*The if statement below is used to select devices that are allowed to retransmit. This can be used to selectively enable retransmissions only for devices that experience a low efficiency in normal conditions; the set of such devices can be determined by first running a run with the setting now active (no retransmissions)
-and then repeating it with the list of imsi IDs of devices that experienced low efficiency (see commented block for an example)*/
-		if(imsi==-1
-		   /*				  	
-			if(imsi==511||
-imsi==523||
-imsi==930||
-imsi==1224||
-imsi==2181||
-imsi==1811||
-imsi==1965||
-imsi==955||
-imsi==957||
-imsi==2249||
-imsi==1924||
-imsi==612||
-imsi==2471||
-imsi==2355||
-imsi==2426||
-imsi==2261||
-imsi==45||
-imsi==54||
-imsi==134||
-imsi==241||
-imsi==778||
-imsi==433||
-imsi==223||
-imsi==347||
-imsi==2460||
-imsi==64||
-imsi==184||
-imsi==195||
-imsi==224||
-imsi==1445||
-imsi==1010||
-imsi==2179||
-imsi==2390||
-imsi==2409||
-imsi==1645||
-imsi==2040||
-imsi==2184||
-imsi==1742||
-imsi==56||
-imsi==58||
-imsi==1390||
-imsi==2407||
-imsi==1436||
-imsi==1187||
-imsi==764||
-imsi==2310||
-imsi==431||
-imsi==635||
-imsi==1559||
-imsi==2028||
-imsi==2442||
-imsi==1194||
-imsi==812||
-imsi==2284||
-imsi==438||
-imsi==1095||
-imsi==1792||
-imsi==2419||
-imsi==2491||
-imsi==2333||
-imsi==2301||
-imsi==2329||
-imsi==2480||
-imsi==542||
-imsi==2477||
-imsi==515||
-imsi==2385||
-imsi==2263||
-imsi==2283||
-imsi==2254||
-imsi==2396||
-imsi==2465||
-imsi==2314||
-imsi==2293||
-imsi==2381||
-imsi==2258||
-imsi==2302||
-imsi==2257||
-imsi==2470||
-imsi==2445||
-imsi==2441||
-imsi==2282||
-imsi==2397||
-imsi==2453||
-imsi==2286||
-imsi==2415||
-imsi==2348||
-imsi==2379||
-imsi==2383||
-imsi==2436||
-imsi==2335||
-imsi==2264||
-imsi==2253||
-imsi==2297||
-imsi==352||
-imsi==1779||
-imsi==1778||
-imsi==2016||
-imsi==629||
-imsi==1545||
-imsi==602||
-imsi==642||
-imsi==700||
-imsi==158||
-imsi==246||
-imsi==1916||
-imsi==337||
-imsi==12||
-imsi==74||
-imsi==159||
-imsi==33||
-imsi==1481||
-imsi==2009||
-imsi==902||
-imsi==1028||
-imsi==1427||
-imsi==913||
-imsi==2193||
-imsi==269||
-imsi==1094||
-imsi==557||
-imsi==2289||
-imsi==399||
-imsi==1646||
-imsi==2476||
-imsi==474||
-imsi==2066||
-imsi==1977||
-imsi==2144||
-imsi==559||
-imsi==312||
-imsi==1089||
-imsi==1304||
-imsi==1741||
-imsi==1883||
-imsi==1190||
-imsi==1888||
-imsi==1790||
-imsi==2005)
-		   */
-		{
-		  ulClientOne.SetAttribute ("PacketSize", UintegerValue(pacchetto*32));//The mupltiplying factor here determines the number of retransmissions (32 in this case)
-		std::cout<<"YESrepeat"<<std::endl;
-		}
-      		else
-      		{
-      		ulClientOne.SetAttribute ("PacketSize", UintegerValue(pacchetto));
-		std::cout<<"NOrepeat"<<std::endl;
-      		}
-		
-		
-				
-      		clientApps.Add (dlClientOne.Install (remoteHost));
-      		clientApps.Add (ulClientOne.Install (ueNodesOne.Get(u)));
-
-      		serverApps.Start (Seconds ((startTimeSecondsOne->GetValue ())));
-      		clientApps.Start (Seconds ((startTimeSecondsOne->GetValue ())));
+	Ptr<UplinkCollector> ulCollector = CreateObject<UplinkCollector> ();
+	ulCollector->SetAttribute ("Port", UintegerValue (ulPort));
+	remoteHost->AddApplication (ulCollector);
+	serverApps.Add (ulCollector);
 
-    	}
+	FlowReporter flowReporter ("FlowReport" + tag.str () + ".csv", flowReportInterval);
+	if (flowReportInterval > 0)
+		ulCollector->AddRxCallback (MakeCallback (&FlowReporter::UplinkRx, &flowReporter));
 
-	for (uint32_t v = 0; v < ueNodesTwo.GetN (); ++v) 	 
+	// Classes with a DL reachability profile get their DL from the network
+	// side when reachable instead of the wheel; an UL report wakes the UE up
+	DlReachabilityModel dlReachabilityModel (dlReachability);
+	if (!dlReachability.empty ())
 	{
-      		++ulPort;		
-		PacketSinkHelper dlPacketSinkHelper ("ns3::UdpSocketFactory", InetSocketAddress (Ipv4Address::GetAny (), dlPort));
-     	 	PacketSinkHelper ulPacketSinkHelper ("ns3::UdpSocketFactory", InetSocketAddress (Ipv4Address::GetAny (), ulPort));
-		serverApps.Add (dlPacketSinkHelper.Install (ueNodesTwo.Get(v)));
-      		serverApps.Add (ulPacketSinkHelper.Install (remoteHost));
-
-		UdpClientHelper dlClientTwo (ueIpIfaceTwo.GetAddress (v), dlPort);
-      		//dlClientTwo.SetAttribute ("Interval", TimeValue (Seconds(interPacketIntervalTwo)));
-      		dlClientTwo.SetAttribute ("Interval", TimeValue (MilliSeconds(interPacketIntervalTwo)));
-      		dlClientTwo.SetAttribute ("MaxPackets", UintegerValue(1000000));
-      		dlClientTwo.SetAttribute ("PacketSize", UintegerValue(200));
-      		
-		UdpClientHelper ulClientTwo (remoteHostAddr, ulPort);
-      		//ulClientTwo.SetAttribute ("Interval", TimeValue (Seconds(interPacketIntervalTwo)));
-      		ulClientTwo.SetAttribute ("Interval", TimeValue (MilliSeconds(interPacketIntervalTwo)));
-      		ulClientTwo.SetAttribute ("MaxPackets", UintegerValue(1000000));
-		
-		Ptr<MobilityModel> modelNodeTwo = ueNodesTwo.Get(v)->GetObject<MobilityModel>();
-		double distance1 = modelNodeTwo->GetDistanceFrom(modelENB1);
-		double distance2 = modelNodeTwo->GetDistanceFrom(modelENB2);
-		double distance3 = modelNodeTwo->GetDistanceFrom(modelENB3);
-		double distance4 = modelNodeTwo->GetDistanceFrom(modelENB4);
-		double distance5 = modelNodeTwo->GetDistanceFrom(modelENB5);
-		double distance6 = modelNodeTwo->GetDistanceFrom(modelENB6);
-		double distance7 = modelNodeTwo->GetDistanceFrom(modelENB7);
-		double distance8 = modelNodeTwo->GetDistanceFrom(modelENB8);
-		double distance9 = modelNodeTwo->GetDistanceFrom(modelENB9);
-		double distance10 = modelNodeTwo->GetDistanceFrom(modelENB10);
-		double distance11 = modelNodeTwo->GetDistanceFrom(modelENB11);
-		double distance12 = modelNodeTwo->GetDistanceFrom(modelENB12);
-		double distance13 = modelNodeTwo->GetDistanceFrom(modelENB13);
-		double distance14 = modelNodeTwo->GetDistanceFrom(modelENB14);
-		double distance15 = modelNodeTwo->GetDistanceFrom(modelENB15);
-		
-		
-		double distancearray[] = {distance1, distance2, distance3, distance4, distance5, distance6, distance7, distance8, distance9, distance10, distance11, distance12, distance13, distance14, distance15};
-		
-    		double distance = 30000;
-int imsi=0;
-    		for ( int i = 0; i <= 14; i++ )
-        		{
-        		if ( distancearray[i] < distance )
-            		distance = distancearray[i];
-			
-			}
-		imsi =ueDevsTwo.Get(v)->GetObject<LteUeNetDevice>()->GetImsi();
-			std::cout<<imsi<<", ";
-
-		for ( int i = 0; i <= 14; i++ )
-        		{
-        		if ( distancearray[i] == distance )
-			std::cout<<i+1<<", ";
-			}
-		std::cout<<"B, ";
-		std::cout<<distance<<", ";
-		if(imsi==511||
-imsi==523||
-imsi==930||
-imsi==1224||
-imsi==2181||
-imsi==1811||
-imsi==1965||
-imsi==955||
-imsi==957||
-imsi==2249||
-imsi==1924||
-imsi==612||
-imsi==2471||
-imsi==2355||
-imsi==2426||
-imsi==2261||
-imsi==45||
-imsi==54||
-imsi==134||
-imsi==241||
-imsi==778||
-imsi==433||
-imsi==223||
-imsi==347||
-imsi==2460||
-imsi==64||
-imsi==184||
-imsi==195||
-imsi==224||
-imsi==1445||
-imsi==1010||
-imsi==2179||
-imsi==2390||
-imsi==2409||
-imsi==1645||
-imsi==2040||
-imsi==2184||
-imsi==1742||
-imsi==56||
-imsi==58||
-imsi==1390||
-imsi==2407||
-imsi==1436||
-imsi==1187||
-imsi==764||
-imsi==2310||
-imsi==431||
-imsi==635||
-imsi==1559||
-imsi==2028||
-imsi==2442||
-imsi==1194||
-imsi==812||
-imsi==2284||
-imsi==438||
-imsi==1095||
-imsi==1792||
-imsi==2419||
-imsi==2491||
-imsi==2333||
-imsi==2301||
-imsi==2329||
-imsi==2480||
-imsi==542||
-imsi==2477||
-imsi==515||
-imsi==2385||
-imsi==2263||
-imsi==2283||
-imsi==2254||
-imsi==2396||
-imsi==2465||
-imsi==2314||
-imsi==2293||
-imsi==2381||
-imsi==2258||
-imsi==2302||
-imsi==2257||
-imsi==2470||
-imsi==2445||
-imsi==2441||
-imsi==2282||
-imsi==2397||
-imsi==2453||
-imsi==2286||
-imsi==2415||
-imsi==2348||
-imsi==2379||
-imsi==2383||
-imsi==2436||
-imsi==2335||
-imsi==2264||
-imsi==2253||
-imsi==2297||
-imsi==352||
-imsi==1779||
-imsi==1778||
-imsi==2016||
-imsi==629||
-imsi==1545||
-imsi==602||
-imsi==642||
-imsi==700||
-imsi==158||
-imsi==246||
-imsi==1916||
-imsi==337||
-imsi==12||
-imsi==74||
-imsi==159||
-imsi==33||
-imsi==1481||
-imsi==2009||
-imsi==902||
-imsi==1028||
-imsi==1427||
-imsi==913||
-imsi==2193||
-imsi==269||
-imsi==1094||
-imsi==557||
-imsi==2289||
-imsi==399||
-imsi==1646||
-imsi==2476||
-imsi==474||
-imsi==2066||
-imsi==1977||
-imsi==2144||
-imsi==559||
-imsi==312||
-imsi==1089||
-imsi==1304||
-imsi==1741||
-imsi==1883||
-imsi==1190||
-imsi==1888||
-imsi==1790||
-imsi==2005)
-		{
-		ulClientTwo.SetAttribute ("PacketSize", UintegerValue(pacchetto*32));
-		std::cout<<"YESrepeat"<<std::endl;
-		}
-      		else
-      		{
-      		ulClientTwo.SetAttribute ("PacketSize", UintegerValue(pacchetto));
-		std::cout<<"NOrepeat"<<std::endl;
-      		}
-
-      		clientApps.Add (dlClientTwo.Install (remoteHost));
-      		clientApps.Add (ulClientTwo.Install (ueNodesTwo.Get(v)));
+		dlReachabilityModel.Install (remoteHost, dlPort);
+		ulCollector->AddRxCallback (MakeCallback (&DlReachabilityModel::UplinkRx, &dlReachabilityModel));
+	}
 
-      		serverApps.Start (Seconds ((startTimeSecondsTwo->GetValue ())));
-      		clientApps.Start (Seconds ((startTimeSecondsTwo->GetValue ())));
+	// Repetitions are modelled by scaling the UL packet size with the repetition
+	// factor of the UE's coverage-enhancement level, see RepetitionPolicy, unless
+	// the NB-IoT scheduler allocates them
+	RepetitionPolicy repetition (repetitionMode, repetitionImsiFile, repetitionClasses, ceThresholds, ceRepetitions);
+	CouplingLossModel couplingLoss (antennaLut);
+	std::vector<CellConfig> macroCells = CellsOfTier (cells, 1);
+	std::vector<CellConfig> smallCells = CellsOfTier (cells, 2);
 
-    	}
+	ProvisioningLog provisioning (provisioningLog, provisioningFormat, provisioningVerbosity);
 
-	for (uint32_t w = 0; w < ueNodesThree.GetN (); ++w) 	 
+	std::vector<Ptr<TrafficWheel> > wheels;
+	for (uint32_t c = 0; c < mix.size (); ++c)
+	{
+	const TrafficClass &traffic = mix[c];
+	bool networkDl = traffic.dl && dlReachabilityModel.Covers (traffic.label);
+	NS_ABORT_MSG_IF (networkDl && traffic.poisson, "dlReachability needs periodic DL, class " << traffic.label << " is poisson");
+	Ptr<TrafficWheel> wheel = Create<TrafficWheel> (traffic, remoteHost, InetSocketAddress (remoteHostAddr, ulPort), dlPort);
+	wheels.push_back (wheel);
+	for (uint32_t u = 0; u < ueNodesByClass[c].GetN (); ++u) 	 
 	{
-      		++ulPort;		
-		PacketSinkHelper dlPacketSinkHelper ("ns3::UdpSocketFactory", InetSocketAddress (Ipv4Address::GetAny (), dlPort));
-     	 	PacketSinkHelper ulPacketSinkHelper ("ns3::UdpSocketFactory", InetSocketAddress (Ipv4Address::GetAny (), ulPort));
-		serverApps.Add (dlPacketSinkHelper.Install (ueNodesThree.Get(w)));
-      		serverApps.Add (ulPacketSinkHelper.Install (remoteHost));
-
-		UdpClientHelper dlClientThree (ueIpIfaceThree.GetAddress (w), dlPort);
-      		//dlClientThree.SetAttribute ("Interval", TimeValue (Seconds(interPacketIntervalThree)));
-      		dlClientThree.SetAttribute ("Interval", TimeValue (MilliSeconds(interPacketIntervalThree)));
-      		dlClientThree.SetAttribute ("MaxPackets", UintegerValue(1000000));
-      		dlClientThree.SetAttribute ("PacketSize", UintegerValue(200));
-      		
-		UdpClientHelper ulClientThree (remoteHostAddr, ulPort);
-      		//ulClientThree.SetAttribute ("Interval", TimeValue (Seconds(interPacketIntervalThree)));
-      		ulClientThree.SetAttribute ("Interval", TimeValue (MilliSeconds(interPacketIntervalThree)));
-      		ulClientThree.SetAttribute ("MaxPackets", UintegerValue(1000000));
-		
-		
-		Ptr<MobilityModel> modelNodeThree = ueNodesThree.Get(w)->GetObject<MobilityModel>();
-		double distance1 = modelNodeThree->GetDistanceFrom(modelENB1);
-		double distance2 = modelNodeThree->GetDistanceFrom(modelENB2);
-		double distance3 = modelNodeThree->GetDistanceFrom(modelENB3);
-		double distance4 = modelNodeThree->GetDistanceFrom(modelENB4);
-		double distance5 = modelNodeThree->GetDistanceFrom(modelENB5);
-		double distance6 = modelNodeThree->GetDistanceFrom(modelENB6);
-		double distance7 = modelNodeThree->GetDistanceFrom(modelENB7);
-		double distance8 = modelNodeThree->GetDistanceFrom(modelENB8);
-		double distance9 = modelNodeThree->GetDistanceFrom(modelENB9);
-		double distance10 = modelNodeThree->GetDistanceFrom(modelENB10);
-		double distance11 = modelNodeThree->GetDistanceFrom(modelENB11);
-		double distance12 = modelNodeThree->GetDistanceFrom(modelENB12);
-		double distance13 = modelNodeThree->GetDistanceFrom(modelENB13);
-		double distance14 = modelNodeThree->GetDistanceFrom(modelENB14);
-		double distance15 = modelNodeThree->GetDistanceFrom(modelENB15);
-		
-		
-		double distancearray[] = {distance1, distance2, distance3, distance4, distance5, distance6, distance7, distance8, distance9, distance10, distance11, distance12, distance13, distance14, distance15};
-		int imsi=0;
-    		double distance = 30000;
-
-    		for ( int i = 0; i <= 14; i++ )
-        		{
-        		if ( distancearray[i] < distance )
-            		distance = distancearray[i];
-			
-			}
-		imsi =ueDevsThree.Get(w)->GetObject<LteUeNetDevice>()->GetImsi();
-			std::cout<<imsi<<", ";
-
-		for ( int i = 0; i <= 14; i++ )
-        		{
-        		if ( distancearray[i] == distance )
-			std::cout<<i+1<<", ";
-			}
-		std::cout<<"C, ";
-		std::cout<<distance<<", ";
-		if(imsi==511||
-imsi==523||
-imsi==930||
-imsi==1224||
-imsi==2181||
-imsi==1811||
-imsi==1965||
-imsi==955||
-imsi==957||
-imsi==2249||
-imsi==1924||
-imsi==612||
-imsi==2471||
-imsi==2355||
-imsi==2426||
-imsi==2261||
-imsi==45||
-imsi==54||
-imsi==134||
-imsi==241||
-imsi==778||
-imsi==433||
-imsi==223||
-imsi==347||
-imsi==2460||
-imsi==64||
-imsi==184||
-imsi==195||
-imsi==224||
-imsi==1445||
-imsi==1010||
-imsi==2179||
-imsi==2390||
-imsi==2409||
-imsi==1645||
-imsi==2040||
-imsi==2184||
-imsi==1742||
-imsi==56||
-imsi==58||
-imsi==1390||
-imsi==2407||
-imsi==1436||
-imsi==1187||
-imsi==764||
-imsi==2310||
-imsi==431||
-imsi==635||
-imsi==1559||
-imsi==2028||
-imsi==2442||
-imsi==1194||
-imsi==812||
-imsi==2284||
-imsi==438||
-imsi==1095||
-imsi==1792||
-imsi==2419||
-imsi==2491||
-imsi==2333||
-imsi==2301||
-imsi==2329||
-imsi==2480||
-imsi==542||
-imsi==2477||
-imsi==515||
-imsi==2385||
-imsi==2263||
-imsi==2283||
-imsi==2254||
-imsi==2396||
-imsi==2465||
-imsi==2314||
-imsi==2293||
-imsi==2381||
-imsi==2258||
-imsi==2302||
-imsi==2257||
-imsi==2470||
-imsi==2445||
-imsi==2441||
-imsi==2282||
-imsi==2397||
-imsi==2453||
-imsi==2286||
-imsi==2415||
-imsi==2348||
-imsi==2379||
-imsi==2383||
-imsi==2436||
-imsi==2335||
-imsi==2264||
-imsi==2253||
-imsi==2297||
-imsi==352||
-imsi==1779||
-imsi==1778||
-imsi==2016||
-imsi==629||
-imsi==1545||
-imsi==602||
-imsi==642||
-imsi==700||
-imsi==158||
-imsi==246||
-imsi==1916||
-imsi==337||
-imsi==12||
-imsi==74||
-imsi==159||
-imsi==33||
-imsi==1481||
-imsi==2009||
-imsi==902||
-imsi==1028||
-imsi==1427||
-imsi==913||
-imsi==2193||
-imsi==269||
-imsi==1094||
-imsi==557||
-imsi==2289||
-imsi==399||
-imsi==1646||
-imsi==2476||
-imsi==474||
-imsi==2066||
-imsi==1977||
-imsi==2144||
-imsi==559||
-imsi==312||
-imsi==1089||
-imsi==1304||
-imsi==1741||
-imsi==1883||
-imsi==1190||
-imsi==1888||
-imsi==1790||
-imsi==2005)
+		ApplicationContainer dlSink;
+		if (traffic.dl)
 		{
-		ulClientThree.SetAttribute ("PacketSize", UintegerValue(pacchetto*32));
-		std::cout<<"YESrepeat"<<std::endl;
+			PacketSinkHelper dlPacketSinkHelper ("ns3::UdpSocketFactory", InetSocketAddress (Ipv4Address::GetAny (), dlPort));
+			dlSink = dlPacketSinkHelper.Install (ueNodesByClass[c].Get(u));
+			serverApps.Add (dlSink);
 		}
-      		else
-      		{
-      		ulClientThree.SetAttribute ("PacketSize", UintegerValue(pacchetto));
-		std::cout<<"NOrepeat"<<std::endl;
-      		}
 
+		const UeAssociation &association = associations[c][u];
+		uint64_t imsi = ueDevsByClass[c].Get(u)->GetObject<LteUeNetDevice>()->GetImsi();
+		ulCollector->AddUe (ueIpIfaceByClass[c].GetAddress (u), imsi);
 
-      		clientApps.Add (dlClientThree.Install (remoteHost));
-      		clientApps.Add (ulClientThree.Install (ueNodesThree.Get(w)));
+		double servingLoss = 0;
+		if (repetition.NeedsCouplingLoss ())
+		{
+			Ptr<MobilityModel> ueMobility = ueNodesByClass[c].Get(u)->GetObject<MobilityModel>();
+			if (association.useSmallCell)
+				servingLoss = couplingLoss.GetLossDb (smallCells[association.smallCell], enbNodes2.Get (association.smallCell)->GetObject<MobilityModel> (), ueMobility);
+			else
+				servingLoss = couplingLoss.GetLossDb (macroCells[association.macroCell], enbNodes1.Get (association.macroCell)->GetObject<MobilityModel> (), ueMobility);
+		}
+		const CellConfig &servingCell = association.useSmallCell ? smallCells[association.smallCell] : macroCells[association.macroCell];
+		uint32_t ceLevel = repetition.GetCeLevel (imsi, traffic.label, servingLoss, servingCell);
+		uint32_t ulScale = repetition.GetRepetitions (ceLevel);
+		if (nbiotScheduler)
+		{
+			ceNotifier.SetCeLevel (imsi, ceLevel);
+			ulScale = 1;
+		}
 
-      		serverApps.Start (Seconds ((startTimeSecondsThree->GetValue ())));
-      		clientApps.Start (Seconds ((startTimeSecondsThree->GetValue ())));
+		ProvisioningRecord record;
+		record.imsi = imsi;
+		record.trafficClass = traffic.label;
+		record.macroCell = association.macroCell;
+		record.macroDistance = association.macroDistance;
+		record.smallCell = association.smallCell;
+		record.smallDistance = association.smallDistance;
+		record.useSmallCell = association.useSmallCell;
+		record.ceLevel = ceLevel;
+		record.repetition = ceLevel > 0;
+		provisioning.Add (record);
+
+		if (flowReportInterval > 0)
+		{
+			uint16_t servingCellId = association.useSmallCell
+				? enbDevs2.Get (association.smallCell)->GetObject<LteEnbNetDevice> ()->GetCellId ()
+				: enbDevs.Get (association.macroCell)->GetObject<LteEnbNetDevice> ()->GetCellId ();
+			if (traffic.dl)
+				flowReporter.AddDownlinkFlow (dlSink.Get (0), traffic.label, servingCellId);
+			if (traffic.ul)
+				flowReporter.AddUplinkFlow (imsi, traffic.label, servingCellId);
+		}
 
+		if (networkDl)
+		{
+			Time dlStart = startByClass[c].Schedule (dlSink, ApplicationContainer ());
+			dlReachabilityModel.AddUe (imsi, traffic.label, ueIpIfaceByClass[c].GetAddress (u), dlStart,
+			                        Seconds (traffic.period), traffic.dlSize.GetMean ());
+		}
+		else if (traffic.dl)
+			wheel->AddDownlink (ueIpIfaceByClass[c].GetAddress (u), startByClass[c].Schedule (dlSink, ApplicationContainer ()));
+		if (traffic.ul)
+			wheel->AddUplink (ueNodesByClass[c].Get(u), startByClass[c].Schedule (ApplicationContainer (), ApplicationContainer ()), ulScale);
     	}
+	std::cout << "Traffic class " << traffic.label << ": " << ueNodesByClass[c].GetN () << " UEs, "
+	          << wheel->GetFlows () << " flows on one timer wheel" << std::endl;
+	}
+	provisioning.Close ();
+
+	double nUes = std::max (1u, allUes.GetN ());
+	std::cout << "UE footprint [B/UE], " << (staticUeStack ? "static" : "full") << " stack: lteDevice "
+	          << (double (heapLteDevice) - heapBefore) / nUes << ", ipStack " << (double (heapIpStack) - heapLteDevice) / nUes
+	          << ", routing " << (double (heapRouting) - heapIpStack) / nUes << ", applications "
+	          << (double (HeapInUse ()) - heapApplications) / nUes << std::endl;
 /*
 	//Insert RLC Performance Calculator
 	Ptr<RadioEnvironmentMapHelper> remHelper;
@@ -1692,41 +1495,3327 @@ imsi==2005)
 
 
 
-        std::string dlOutFname = "DlRlcStats";
-	dlOutFname.append (tag.str ());
-        std::string ulOutFname = "UlRlcStats";
-	ulOutFname.append (tag.str ());
-
-	lteHelper->EnableTraces ();
-
-	//FlowMonitorHelper fmHelper;
-	//Ptr<FlowMonitor> allMon = fmHelper.InstallAll();
-	//Simulator::Schedule(Seconds(simTime+simTime*0.2),&ThroughputMonitor,&fmHelper, allMon);
+	phases.Mark ("traceEnable");
+	traceRecorder.Install (lteHelper, enbDevs, enbDevs2, ueDevsByClass);
 
+	phases.Mark ("run");
 	Simulator::Stop (Seconds (simTime));
+	uint64_t eventsBefore = Simulator::GetEventCount ();
+	std::chrono::steady_clock::time_point runStart = std::chrono::steady_clock::now ();
   	Simulator::Run ();
+	double runSeconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - runStart).count ();
+	uint64_t runEvents = Simulator::GetEventCount () - eventsBefore;
+	traceRecorder.Close ();
+	if (!ulStatsFile.empty ())
+		ulCollector->Report (ulStatsFile);
+	flowReporter.Close ();
+	if (!dlReachability.empty ())
+		dlReachabilityModel.Report ("DlReachability" + tag.str () + ".csv");
+
+	if (!kpiFile.empty ())
+	{
+		uint64_t ulPackets, ulLost;
+		double ulLatencyMs;
+		ulCollector->GetTotals (ulPackets, ulLost, ulLatencyMs);
+		uint64_t dlBytes = 0;
+		for (uint32_t i = 0; i < serverApps.GetN (); ++i)
+		{
+			Ptr<PacketSink> sink = DynamicCast<PacketSink> (serverApps.Get (i));
+			if (sink)
+				dlBytes += sink->GetTotalRx ();
+		}
+		struct rusage usage;
+		getrusage (RUSAGE_SELF, &usage);
+		std::ofstream kpis (kpiFile.c_str ());
+		kpis << "ulPackets " << ulPackets << "\n"
+		     << "ulLossRatio " << (ulPackets + ulLost > 0 ? double (ulLost) / (ulPackets + ulLost) : 0) << "\n"
+		     << "ulLatencyMs " << ulLatencyMs << "\n"
+		     << "dlThroughputKbps " << dlBytes * 8 / simTime / 1000 << "\n"
+		     << "events " << runEvents << "\n"
+		     << "eventsPerSecond " << (runSeconds > 0 ? runEvents / runSeconds : 0) << "\n"
+		     << "simSecondsPerWallSecond " << (runSeconds > 0 ? simTime / runSeconds : 0) << "\n"
+		     << "peakRssMb " << usage.ru_maxrss / 1024.0 << "\n"
+		     << "outputBytes " << OutputBytes (tag.str (), startTime) << "\n"
+		     << "wallSeconds " << std::chrono::duration<double> (std::chrono::steady_clock::now () - wallStart).count () << "\n";
+	}
 
-  	//ThroughputMonitor(&fmHelper, allMon);
-
+	phases.Mark ("destroy");
 	Simulator::Destroy();
+	delete g_couplingLossTable;
+	g_couplingLossTable = 0;
+	if (phaseReport)
+		phases.Write ("PhaseReport" + tag.str () + ".json");
 	return 0;
 }
 
-void ThroughputMonitor (FlowMonitorHelper *fmhelper, Ptr<FlowMonitor> flowMon)
-	{
-		std::map<FlowId, FlowMonitor::FlowStats> flowStats = flowMon->GetFlowStats();
-		Ptr<Ipv4FlowClassifier> classing = DynamicCast<Ipv4FlowClassifier> (fmhelper->GetClassifier());
-		for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator stats = flowStats.begin (); stats != flowStats.end (); ++stats)
-		{
-			Ipv4FlowClassifier::FiveTuple fiveTuple = classing->FindFlow (stats->first);
-			std::cout<<"Flow ID			: " << stats->first <<" ; "<< fiveTuple.sourceAddress <<" -----> "<<fiveTuple.destinationAddress<<std::endl;
-			std::cout<<"Tx Bytes = " << stats->second.txBytes<<std::endl;
-			std::cout<<"Rx Bytes = " << stats->second.rxBytes<<std::endl;
-			std::cout<<"Duration		: "<<stats->second.timeLastRxPacket.GetSeconds()-stats->second.timeFirstTxPacket.GetSeconds()<<std::endl;
-			std::cout<<"Last Received Packet	: "<< stats->second.timeLastRxPacket.GetSeconds()<<" Seconds"<<std::endl;
-			std::cout<<"Throughput: " << stats->second.rxBytes * 8.0 / (stats->second.timeLastRxPacket.GetSeconds()-stats->second.timeFirstTxPacket.GetSeconds())/1024/1024  << " 				Mbps"<<std::endl;
-			std::cout<<"---------------------------------------------------------------------------"<<std::endl;
-		}
-			Simulator::Schedule(Seconds(1),&ThroughputMonitor, fmhelper, flowMon);
+std::vector<CellConfig> DefaultTopology ()
+{
+  // 5 three-sector macro sites (800 MHz, band 20) and 15 isotropic small
+  // cells (2100 MHz, band 1), each tier on its own DL and UL carrier
+  static const CellConfig layout[] = {
+    {1, 1, 1.0, 0.17, 23.0, 10, 60, 20.0, 43.0, 24300, 12, 6300},
+    {1, 1, -0.5, 0.86, 23.0, 120, 60, 15.0, 43.0, 24300, 12, 6300},
+    {1, 1, 0.17, -0.98, 23.0, 280, 60, 20.0, 43.0, 24300, 12, 6300},
+    {2, 1, -331.1, 697.34, 23.0, 350, 60, 20.0, 43.0, 24300, 12, 6300},
+    {2, 1, -332.0, 698.0, 23.0, 90, 60, 15.0, 43.0, 24300, 12, 6300},
+    {2, 1, -332.76, 696.35, 23.0, 220, 60, 15.0, 43.0, 24300, 12, 6300},
+    {3, 1, -677.5, -769.13, 23.0, 60, 60, 15.0, 43.0, 24300, 12, 6300},
+    {3, 1, -679.0, -770.0, 23.0, 180, 60, 15.0, 43.0, 24300, 12, 6300},
+    {3, 1, -677.5, -770.86, 23.0, 300, 60, 15.0, 43.0, 24300, 12, 6300},
+    {4, 1, 570.98, -377.17, 23.0, 350, 60, 20.0, 43.0, 24300, 12, 6300},
+    {4, 1, 569.1, -376.5, 23.0, 150, 60, 15.0, 43.0, 24300, 12, 6300},
+    {4, 1, 569.83, -377.98, 23.0, 220, 60, 15.0, 43.0, 24300, 12, 6300},
+    {5, 1, -1066.66, -79.1, 23.0, 10, 60, 20.0, 43.0, 24300, 12, 6300},
+    {5, 1, -1067.98, -79.83, 23.0, 140, 60, 15.0, 43.0, 24300, 12, 6300},
+    {5, 1, -1066.35, -80.77, 23.0, 300, 60, 15.0, 43.0, 24300, 12, 6300},
+    {6, 2, -600.1, 200.2, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {7, 2, -1000, 700, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {8, 2, 600.3, 600.3, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {9, 2, -750.2, 600, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {10, 2, -1100.3, -750.1, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {11, 2, -450.2, -100, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {12, 2, 650.5, 100.2, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {13, 2, -1000.2, -500.1, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {14, 2, 200.5, -800.1, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {15, 2, -200, -750.1, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {16, 2, 300.4, 780.2, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {17, 2, 0.2, 500.5, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {18, 2, -1100.3, 400.8, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {19, 2, 600.5, -800.6, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+    {20, 2, 0.7, -450, 0.1, 0, 0, 0.0, 23.0, 18300, 12, 300},
+  };
+  return std::vector<CellConfig> (layout, layout + sizeof (layout) / sizeof (layout[0]));
+}
 
-	}
+// Binary layout: "NBT2", uint32 cell count, then fixed 76-byte records in host
+// byte order. "NBT1" files have 72-byte records without dlEarfcn.
+static const char g_topologyMagic[4] = {'N', 'B', 'T', '2'};
+static const uint32_t g_topologyRecordSize = 5 * sizeof (uint32_t) + 7 * sizeof (double);
+static const uint32_t g_defaultDlEarfcn = 100;    // LteEnbNetDevice::DlEarfcn
+
+static std::vector<CellConfig>
+LoadTopologyBinary (std::string fileName)
+{
+  std::ifstream in (fileName.c_str (), std::ios::binary);
+  NS_ABORT_MSG_UNLESS (in.is_open (), "Cannot open topology file " << fileName);
+  std::vector<char> buf ((std::istreambuf_iterator<char> (in)), std::istreambuf_iterator<char> ());
+  uint32_t count = 0;
+  NS_ABORT_MSG_IF (buf.size () < 8 || std::memcmp (&buf[0], g_topologyMagic, 3) != 0
+                   || (buf[3] != '1' && buf[3] != g_topologyMagic[3]),
+                   "Not a binary topology file: " << fileName);
+  bool withDlEarfcn = buf[3] == g_topologyMagic[3];
+  uint32_t recordSize = withDlEarfcn ? g_topologyRecordSize : g_topologyRecordSize - 4;
+  std::memcpy (&count, &buf[4], sizeof (count));
+  NS_ABORT_MSG_IF (buf.size () != 8 + (size_t) count * recordSize,
+                   "Truncated binary topology file: " << fileName);
+
+  std::vector<CellConfig> cells (count);
+  const char *p = &buf[8];
+  for (uint32_t i = 0; i < count; ++i)
+    {
+      CellConfig &c = cells[i];
+      std::memcpy (&c.site, p, 4); p += 4;
+      std::memcpy (&c.tier, p, 4); p += 4;
+      std::memcpy (&c.x, p, 8); p += 8;
+      std::memcpy (&c.y, p, 8); p += 8;
+      std::memcpy (&c.z, p, 8); p += 8;
+      std::memcpy (&c.azimuth, p, 8); p += 8;
+      std::memcpy (&c.beamwidth, p, 8); p += 8;
+      std::memcpy (&c.maxGain, p, 8); p += 8;
+      std::memcpy (&c.txPower, p, 8); p += 8;
+      std::memcpy (&c.ulEarfcn, p, 4); p += 4;
+      std::memcpy (&c.ulBandwidth, p, 4); p += 4;
+      c.dlEarfcn = g_defaultDlEarfcn;
+      if (withDlEarfcn)
+        {
+          std::memcpy (&c.dlEarfcn, p, 4); p += 4;
+        }
+    }
+  return cells;
+}
+
+static std::vector<CellConfig>
+LoadTopologyCsv (std::string fileName)
+{
+  std::ifstream in (fileName.c_str ());
+  NS_ABORT_MSG_UNLESS (in.is_open (), "Cannot open topology file " << fileName);
+  std::vector<CellConfig> cells;
+  std::string line;
+  uint32_t lineNo = 0;
+  while (std::getline (in, line))
+    {
+      ++lineNo;
+      std::replace (line.begin (), line.end (), ',', ' ');
+      std::istringstream fields (line);
+      std::string first;
+      if (!(fields >> first) || first[0] == '#' || first == "site")
+        {
+          continue; // blank line, comment or header
+        }
+      CellConfig c;
+      fields.clear ();
+      fields.str (line);
+      fields >> c.site >> c.tier >> c.x >> c.y >> c.z >> c.azimuth >> c.beamwidth
+             >> c.maxGain >> c.txPower >> c.ulEarfcn >> c.ulBandwidth;
+      NS_ABORT_MSG_IF (fields.fail (), fileName << ":" << lineNo << ": expected 11 or 12 fields");
+      if (!(fields >> c.dlEarfcn))
+        {
+          c.dlEarfcn = g_defaultDlEarfcn;
+        }
+      NS_ABORT_MSG_IF (c.tier != 1 && c.tier != 2, fileName << ":" << lineNo << ": tier must be 1 or 2");
+      cells.push_back (c);
+    }
+  return cells;
+}
+
+std::vector<CellConfig> LoadTopology (std::string fileName)
+{
+  if (fileName.size () > 4 && fileName.compare (fileName.size () - 4, 4, ".bin") == 0)
+    {
+      return LoadTopologyBinary (fileName);
+    }
+  return LoadTopologyCsv (fileName);
+}
+
+void SaveTopology (std::string fileName, const std::vector<CellConfig> &cells)
+{
+  std::vector<char> buf (8 + cells.size () * g_topologyRecordSize);
+  uint32_t count = cells.size ();
+  std::memcpy (&buf[0], g_topologyMagic, 4);
+  std::memcpy (&buf[4], &count, 4);
+  char *p = &buf[8];
+  for (uint32_t i = 0; i < count; ++i)
+    {
+      const CellConfig &c = cells[i];
+      std::memcpy (p, &c.site, 4); p += 4;
+      std::memcpy (p, &c.tier, 4); p += 4;
+      std::memcpy (p, &c.x, 8); p += 8;
+      std::memcpy (p, &c.y, 8); p += 8;
+      std::memcpy (p, &c.z, 8); p += 8;
+      std::memcpy (p, &c.azimuth, 8); p += 8;
+      std::memcpy (p, &c.beamwidth, 8); p += 8;
+      std::memcpy (p, &c.maxGain, 8); p += 8;
+      std::memcpy (p, &c.txPower, 8); p += 8;
+      std::memcpy (p, &c.ulEarfcn, 4); p += 4;
+      std::memcpy (p, &c.ulBandwidth, 4); p += 4;
+      std::memcpy (p, &c.dlEarfcn, 4); p += 4;
+    }
+  std::ofstream out (fileName.c_str (), std::ios::binary);
+  NS_ABORT_MSG_UNLESS (out.is_open (), "Cannot write topology file " << fileName);
+  out.write (&buf[0], buf.size ());
+}
+
+uint32_t CountCells (const std::vector<CellConfig> &cells, uint32_t tier)
+{
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < cells.size (); ++i)
+    {
+      n += (cells[i].tier == tier);
+    }
+  return n;
+}
+
+bool TiersShareCarrier (const std::vector<CellConfig> &cells)
+{
+  for (uint32_t i = 0; i < cells.size (); ++i)
+    {
+      for (uint32_t j = 0; j < cells.size (); ++j)
+        {
+          if (cells[i].tier == 1 && cells[j].tier == 2
+              && (cells[i].dlEarfcn == cells[j].dlEarfcn || cells[i].ulEarfcn == cells[j].ulEarfcn))
+            {
+              return true;
+            }
+        }
+    }
+  return false;
+}
+
+void InstallCellMobility (const std::vector<CellConfig> &cells, NodeContainer macroNodes, NodeContainer smallNodes)
+{
+  Ptr<ListPositionAllocator> macroPositions = CreateObject<ListPositionAllocator> ();
+  Ptr<ListPositionAllocator> smallPositions = CreateObject<ListPositionAllocator> ();
+  for (uint32_t i = 0; i < cells.size (); ++i)
+    {
+      Ptr<ListPositionAllocator> alloc = cells[i].tier == 1 ? macroPositions : smallPositions;
+      alloc->Add (Vector (cells[i].x, cells[i].y, cells[i].z));
+    }
+
+  MobilityHelper mobility;
+  mobility.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
+  mobility.SetPositionAllocator (macroPositions);
+  mobility.Install (macroNodes);
+  mobility.SetPositionAllocator (smallPositions);
+  mobility.Install (smallNodes);
+}
+
+// Everything InstallEnbDevice needs reconfigured between two cells
+struct CellProfileKey
+{
+  uint32_t tier;
+  double azimuth;
+  double beamwidth;
+  double maxGain;
+  double txPower;
+  uint32_t ulEarfcn;
+  uint32_t ulBandwidth;
+  uint32_t dlEarfcn;
+
+  bool operator< (const CellProfileKey &o) const
+  {
+    if (tier != o.tier) return tier < o.tier;
+    if (azimuth != o.azimuth) return azimuth < o.azimuth;
+    if (beamwidth != o.beamwidth) return beamwidth < o.beamwidth;
+    if (maxGain != o.maxGain) return maxGain < o.maxGain;
+    if (txPower != o.txPower) return txPower < o.txPower;
+    if (ulEarfcn != o.ulEarfcn) return ulEarfcn < o.ulEarfcn;
+    if (ulBandwidth != o.ulBandwidth) return ulBandwidth < o.ulBandwidth;
+    return dlEarfcn < o.dlEarfcn;
+  }
+};
+
+void InstallCellDevices (Ptr<LteHelper> lteHelper, const std::vector<CellConfig> &cells,
+                         NodeContainer macroNodes, NodeContainer smallNodes,
+                         NetDeviceContainer &macroDevs, NetDeviceContainer &smallDevs, bool couplingLossCache,
+                         double antennaLutResolution, uint32_t onlyTier)
+{
+  // Group the cells by profile. Profiles are installed in order of first
+  // appearance, so cell IDs only depend on the layout file.
+  std::map<CellProfileKey, uint32_t> profileIndex;
+  std::vector<std::vector<uint32_t> > profileCells;
+  std::vector<uint32_t> tierIndex (cells.size ());
+  uint32_t nMacro = 0;
+  uint32_t nSmall = 0;
+  for (uint32_t i = 0; i < cells.size (); ++i)
+    {
+      const CellConfig &c = cells[i];
+      tierIndex[i] = c.tier == 1 ? nMacro++ : nSmall++;
+      if (onlyTier > 0 && c.tier != onlyTier)
+        {
+          continue;
+        }
+      bool isotropic = c.beamwidth <= 0;
+      CellProfileKey key = {c.tier, isotropic ? 0 : c.azimuth, isotropic ? 0 : c.beamwidth,
+                            isotropic ? 0 : c.maxGain, c.txPower, c.ulEarfcn, c.ulBandwidth, c.dlEarfcn};
+      std::map<CellProfileKey, uint32_t>::iterator it = profileIndex.find (key);
+      if (it == profileIndex.end ())
+        {
+          it = profileIndex.insert (std::make_pair (key, profileCells.size ())).first;
+          profileCells.push_back (std::vector<uint32_t> ());
+        }
+      profileCells[it->second].push_back (i);
+    }
+
+  std::vector<Ptr<NetDevice> > devices (cells.size ());
+  for (uint32_t p = 0; p < profileCells.size (); ++p)
+    {
+      const CellConfig &c = cells[profileCells[p][0]];
+      Config::SetDefault ("ns3::LteEnbPhy::TxPower", DoubleValue (c.txPower));
+      if (c.beamwidth > 0 && !couplingLossCache)
+        {
+          if (antennaLutResolution > 0)
+            {
+              lteHelper->SetEnbAntennaModelType ("ns3::TabulatedCosineAntennaModel");
+              lteHelper->SetEnbAntennaModelAttribute ("Resolution", DoubleValue (antennaLutResolution));
+            }
+          else
+            {
+              lteHelper->SetEnbAntennaModelType ("ns3::CosineAntennaModel");
+            }
+          lteHelper->SetEnbAntennaModelAttribute ("Orientation", DoubleValue (c.azimuth));
+          lteHelper->SetEnbAntennaModelAttribute ("Beamwidth", DoubleValue (c.beamwidth));
+          lteHelper->SetEnbAntennaModelAttribute ("MaxGain", DoubleValue (c.maxGain));
+        }
+      else
+        {
+          lteHelper->SetEnbAntennaModelType ("ns3::IsotropicAntennaModel");
+        }
+      lteHelper->SetEnbDeviceAttribute ("DlEarfcn", UintegerValue (c.dlEarfcn));
+      lteHelper->SetEnbDeviceAttribute ("UlEarfcn", UintegerValue (c.ulEarfcn));
+      lteHelper->SetEnbDeviceAttribute ("UlBandwidth", UintegerValue (c.ulBandwidth));
+      const TierPathloss &pathloss = g_tierPathloss[c.tier - 1];
+      if (couplingLossCache)
+        {
+          lteHelper->SetAttribute ("PathlossModel", StringValue ("ns3::CachedCouplingLossModel"));
+        }
+      else
+        {
+          lteHelper->SetAttribute ("PathlossModel", StringValue (pathloss.model));
+          lteHelper->SetPathlossModelAttribute ("Frequency", DoubleValue (pathloss.frequency));
+          if (pathloss.rooftopLevel >= 0)
+            {
+              lteHelper->SetPathlossModelAttribute ("RooftopLevel", DoubleValue (pathloss.rooftopLevel));
+            }
+        }
+
+      NodeContainer nodes;
+      for (uint32_t k = 0; k < profileCells[p].size (); ++k)
+        {
+          uint32_t i = profileCells[p][k];
+          nodes.Add ((cells[i].tier == 1 ? macroNodes : smallNodes).Get (tierIndex[i]));
+        }
+      NetDeviceContainer devs = lteHelper->InstallEnbDevice (nodes);
+      for (uint32_t k = 0; k < profileCells[p].size (); ++k)
+        {
+          devices[profileCells[p][k]] = devs.Get (k);
+        }
+    }
+
+  for (uint32_t i = 0; i < cells.size (); ++i)
+    {
+      if (devices[i])
+        {
+          (cells[i].tier == 1 ? macroDevs : smallDevs).Add (devices[i]);
+        }
+    }
+}
+
+CellGridIndex::CellGridIndex (NodeContainer cells)
+  : m_minX (0),
+    m_minY (0),
+    m_bucketSize (1),
+    m_nx (1),
+    m_ny (1)
+{
+  for (uint32_t i = 0; i < cells.GetN (); ++i)
+    {
+      m_positions.push_back (cells.Get (i)->GetObject<MobilityModel> ()->GetPosition ());
+    }
+  if (m_positions.empty ())
+    {
+      return;
+    }
+
+  double maxX = m_positions[0].x;
+  double maxY = m_positions[0].y;
+  m_minX = maxX;
+  m_minY = maxY;
+  for (uint32_t i = 1; i < m_positions.size (); ++i)
+    {
+      m_minX = std::min (m_minX, m_positions[i].x);
+      m_minY = std::min (m_minY, m_positions[i].y);
+      maxX = std::max (maxX, m_positions[i].x);
+      maxY = std::max (maxY, m_positions[i].y);
+    }
+  // About one cell per bucket
+  double width = std::max (maxX - m_minX, 1.0);
+  double height = std::max (maxY - m_minY, 1.0);
+  m_bucketSize = std::sqrt (width * height / m_positions.size ());
+  m_nx = std::min<int32_t> (std::floor (width / m_bucketSize) + 1, m_positions.size ());
+  m_ny = std::min<int32_t> (std::floor (height / m_bucketSize) + 1, m_positions.size ());
+  m_bucketSize = std::max (width / m_nx, height / m_ny) * (1 + 1e-9);
+
+  std::vector<uint32_t> bucketOf (m_positions.size ());
+  m_bucketStart.assign (m_nx * m_ny + 1, 0);
+  for (uint32_t i = 0; i < m_positions.size (); ++i)
+    {
+      int32_t bx = std::min<int32_t> ((m_positions[i].x - m_minX) / m_bucketSize, m_nx - 1);
+      int32_t by = std::min<int32_t> ((m_positions[i].y - m_minY) / m_bucketSize, m_ny - 1);
+      bucketOf[i] = by * m_nx + bx;
+      ++m_bucketStart[bucketOf[i] + 1];
+    }
+  for (uint32_t b = 1; b < m_bucketStart.size (); ++b)
+    {
+      m_bucketStart[b] += m_bucketStart[b - 1];
+    }
+  m_bucketCells.resize (m_positions.size ());
+  std::vector<uint32_t> fill (m_bucketStart.begin (), m_bucketStart.end () - 1);
+  for (uint32_t i = 0; i < m_positions.size (); ++i)
+    {
+      m_bucketCells[fill[bucketOf[i]]++] = i;
+    }
+}
+
+uint32_t
+CellGridIndex::GetN () const
+{
+  return m_positions.size ();
+}
+
+uint32_t
+CellGridIndex::Nearest (const Vector &position, double &distance) const
+{
+  uint32_t best = std::numeric_limits<uint32_t>::max ();
+  distance = std::numeric_limits<double>::max ();
+  if (m_positions.empty ())
+    {
+      return best;
+    }
+
+  int32_t qx = std::max<int32_t> (0, std::min<int32_t> (std::floor ((position.x - m_minX) / m_bucketSize), m_nx - 1));
+  int32_t qy = std::max<int32_t> (0, std::min<int32_t> (std::floor ((position.y - m_minY) / m_bucketSize), m_ny - 1));
+  int32_t maxRing = std::max (m_nx, m_ny);
+  for (int32_t r = 0; r <= maxRing; ++r)
+    {
+      // Buckets not visited yet are at least r - 1 whole buckets away in the
+      // plane, and the 3D distance is never shorter than the planar one
+      if (distance < (r - 1) * m_bucketSize)
+        {
+          break;
+        }
+      for (int32_t by = qy - r; by <= qy + r; ++by)
+        {
+          if (by < 0 || by >= m_ny)
+            {
+              continue;
+            }
+          bool edgeRow = (by == qy - r || by == qy + r);
+          for (int32_t bx = qx - r; bx <= qx + r; bx += (edgeRow || r == 0) ? 1 : 2 * r)
+            {
+              if (bx < 0 || bx >= m_nx)
+                {
+                  continue;
+                }
+              uint32_t b = by * m_nx + bx;
+              for (uint32_t k = m_bucketStart[b]; k < m_bucketStart[b + 1]; ++k)
+                {
+                  uint32_t i = m_bucketCells[k];
+                  double d = CalculateDistance (position, m_positions[i]);
+                  if (d < distance || (d == distance && i < best))
+                    {
+                      distance = d;
+                      best = i;
+                    }
+                }
+            }
+        }
+    }
+  return best;
+}
+
+static void
+AssociateRange (const std::vector<Vector> *positions, const CellGridIndex *macroIndex,
+                const CellGridIndex *smallIndex, double smallCellRange,
+                std::vector<UeAssociation> *associations, uint32_t begin, uint32_t end)
+{
+  for (uint32_t u = begin; u < end; ++u)
+    {
+      UeAssociation &a = (*associations)[u];
+      a.macroCell = macroIndex->Nearest ((*positions)[u], a.macroDistance);
+      a.smallCell = smallIndex->Nearest ((*positions)[u], a.smallDistance);
+      a.useSmallCell = a.smallDistance < a.macroDistance && a.smallDistance < smallCellRange;
+    }
+}
+
+std::vector<std::vector<UeAssociation> > BulkAttach (Ptr<LteHelper> lteHelper, const std::vector<NetDeviceContainer> &ueDevs,
+                                                     NetDeviceContainer macroDevs, NetDeviceContainer smallDevs,
+                                                     const CellGridIndex &macroIndex, const CellGridIndex &smallIndex,
+                                                     double smallCellRange, uint32_t workers)
+{
+  NS_ABORT_MSG_IF (macroIndex.GetN () == 0, "The cell layout needs at least one macro cell");
+
+  // Snapshot the positions here: Ptr reference counts are not thread safe
+  std::vector<Vector> positions;
+  for (uint32_t c = 0; c < ueDevs.size (); ++c)
+    {
+      for (uint32_t u = 0; u < ueDevs[c].GetN (); ++u)
+        {
+          positions.push_back (ueDevs[c].Get (u)->GetNode ()->GetObject<MobilityModel> ()->GetPosition ());
+        }
+    }
+
+  // Static partition in contiguous chunks; small batches stay on this thread
+  uint32_t n = positions.size ();
+  std::vector<UeAssociation> flat (n);
+  if (workers == 0)
+    {
+      workers = std::max (1u, std::thread::hardware_concurrency ());
+    }
+  workers = std::max (1u, std::min (workers, n / 1024));
+  uint32_t chunk = (n + workers - 1) / workers;
+  std::vector<std::thread> pool;
+  for (uint32_t w = 1; w < workers; ++w)
+    {
+      pool.push_back (std::thread (AssociateRange, &positions, &macroIndex, &smallIndex, smallCellRange,
+                                   &flat, std::min (n, w * chunk), std::min (n, (w + 1) * chunk)));
+    }
+  AssociateRange (&positions, &macroIndex, &smallIndex, smallCellRange, &flat, 0, std::min (n, chunk));
+  for (uint32_t w = 0; w < pool.size (); ++w)
+    {
+      pool[w].join ();
+    }
+
+  std::vector<std::vector<UeAssociation> > associations (ueDevs.size ());
+  uint32_t u = 0;
+  for (uint32_t c = 0; c < ueDevs.size (); ++c)
+    {
+      for (uint32_t i = 0; i < ueDevs[c].GetN (); ++i, ++u)
+        {
+          const UeAssociation &a = flat[u];
+          lteHelper->Attach (ueDevs[c].Get (i), a.useSmallCell ? smallDevs.Get (a.smallCell) : macroDevs.Get (a.macroCell));
+          associations[c].push_back (a);
+        }
+    }
+  return associations;
+}
+
+StartTimeScheduler::StartTimeScheduler (std::string spec, double defaultMax)
+  : m_slotted (false),
+    m_max (defaultMax),
+    m_slot (0),
+    m_jitter (0)
+{
+  m_rv = CreateObject<UniformRandomVariable> ();
+  std::replace (spec.begin (), spec.end (), ':', ' ');
+  std::istringstream fields (spec);
+  std::string mode;
+  fields >> mode;
+  if (mode == "uniform")
+    {
+      if (!(fields >> m_max))
+        {
+          m_max = defaultMax;
+        }
+    }
+  else if (mode == "slotted")
+    {
+      m_slotted = true;
+      fields >> m_slot;
+      NS_ABORT_MSG_IF (fields.fail () || m_slot <= 0, "slotted start needs a positive slot length: " << spec);
+      if (!(fields >> m_jitter))
+        {
+          m_jitter = 0;
+        }
+    }
+  else
+    {
+      NS_FATAL_ERROR ("Unknown start-time distribution: " << spec);
+    }
+}
+
+Time
+StartTimeScheduler::Schedule (ApplicationContainer sink, ApplicationContainer client)
+{
+  double start;
+  if (m_slotted)
+    {
+      uint32_t slots = std::max (1.0, std::floor (m_max / m_slot));
+      start = m_rv->GetInteger (0, slots - 1) * m_slot + m_rv->GetValue (0, m_jitter);
+    }
+  else
+    {
+      start = m_rv->GetValue (0, m_max);
+    }
+  sink.Start (Seconds (start));
+  client.Start (Seconds (start));
+  return Seconds (start);
+}
+
+std::vector<CellConfig> CellsOfTier (const std::vector<CellConfig> &cells, uint32_t tier)
+{
+  std::vector<CellConfig> tierCells;
+  for (uint32_t i = 0; i < cells.size (); ++i)
+    {
+      if (cells[i].tier == tier)
+        {
+          tierCells.push_back (cells[i]);
+        }
+    }
+  return tierCells;
+}
+
+CouplingLossModel::CouplingLossModel (double antennaLutResolution)
+  : m_antennaLutResolution (antennaLutResolution)
+{
+  for (uint32_t t = 0; t < 2; ++t)
+    {
+      ObjectFactory factory (g_tierPathloss[t].model);
+      factory.Set ("Frequency", DoubleValue (g_tierPathloss[t].frequency));
+      if (g_tierPathloss[t].rooftopLevel >= 0)
+        {
+          factory.Set ("RooftopLevel", DoubleValue (g_tierPathloss[t].rooftopLevel));
+        }
+      m_pathloss[t] = factory.Create<PropagationLossModel> ();
+    }
+}
+
+double
+CouplingLossModel::GetLossDb (const CellConfig &cell, Ptr<MobilityModel> enb, Ptr<MobilityModel> ue)
+{
+  double pathlossDb = -m_pathloss[cell.tier - 1]->CalcRxPower (0, enb, ue);
+  if (cell.beamwidth <= 0)
+    {
+      return pathlossDb;
+    }
+
+  std::pair<double, std::pair<double, double> > key (cell.azimuth, std::make_pair (cell.beamwidth, cell.maxGain));
+  Ptr<AntennaModel> &antenna = m_antennas[key];
+  if (!antenna)
+    {
+      ObjectFactory factory (m_antennaLutResolution > 0 ? "ns3::TabulatedCosineAntennaModel" : "ns3::CosineAntennaModel");
+      if (m_antennaLutResolution > 0)
+        {
+          factory.Set ("Resolution", DoubleValue (m_antennaLutResolution));
+        }
+      factory.Set ("Orientation", DoubleValue (cell.azimuth));
+      factory.Set ("Beamwidth", DoubleValue (cell.beamwidth));
+      factory.Set ("MaxGain", DoubleValue (cell.maxGain));
+      antenna = factory.Create<AntennaModel> ();
+    }
+  // Same convention as the spectrum channel: direction of the UE seen from the eNB
+  return pathlossDb - antenna->GetGainDb (Angles (ue->GetPosition (), enb->GetPosition ()));
+}
+
+// Low-efficiency devices of the first run of the two-run campaign
+static const uint64_t g_defaultRepetitionImsis[] = {
+  511, 523, 930, 1224, 2181, 1811, 1965, 955, 957, 2249, 1924, 612,
+  2471, 2355, 2426, 2261, 45, 54, 134, 241, 778, 433, 223, 347,
+  2460, 64, 184, 195, 224, 1445, 1010, 2179, 2390, 2409, 1645, 2040,
+  2184, 1742, 56, 58, 1390, 2407, 1436, 1187, 764, 2310, 431, 635,
+  1559, 2028, 2442, 1194, 812, 2284, 438, 1095, 1792, 2419, 2491, 2333,
+  2301, 2329, 2480, 542, 2477, 515, 2385, 2263, 2283, 2254, 2396, 2465,
+  2314, 2293, 2381, 2258, 2302, 2257, 2470, 2445, 2441, 2282, 2397, 2453,
+  2286, 2415, 2348, 2379, 2383, 2436, 2335, 2264, 2253, 2297, 352, 1779,
+  1778, 2016, 629, 1545, 602, 642, 700, 158, 246, 1916, 337, 12,
+  74, 159, 33, 1481, 2009, 902, 1028, 1427, 913, 2193, 269, 1094,
+  557, 2289, 399, 1646, 2476, 474, 2066, 1977, 2144, 559, 312, 1089,
+  1304, 1741, 1883, 1190, 1888, 1790, 2005,
+};
+
+RepetitionPolicy::RepetitionPolicy (std::string mode, std::string imsiFile, std::string classes,
+                                    std::string thresholds, std::string repetitions)
+  : m_classes (classes)
+{
+  if (mode == "none")
+    {
+      m_mode = NONE;
+    }
+  else if (mode == "list")
+    {
+      m_mode = LIST;
+    }
+  else if (mode == "coupling")
+    {
+      m_mode = COUPLING;
+    }
+  else if (mode == "snr")
+    {
+      m_mode = SNR;
+    }
+  else
+    {
+      NS_FATAL_ERROR ("Unknown repetition mode: " << mode);
+    }
+
+  if (m_mode == LIST && imsiFile.empty ())
+    {
+      m_imsis.insert (g_defaultRepetitionImsis, g_defaultRepetitionImsis
+                      + sizeof (g_defaultRepetitionImsis) / sizeof (g_defaultRepetitionImsis[0]));
+    }
+  else if (m_mode == LIST)
+    {
+      std::ifstream in (imsiFile.c_str ());
+      NS_ABORT_MSG_UNLESS (in.is_open (), "Cannot open IMSI list " << imsiFile);
+      std::string line;
+      while (std::getline (in, line))
+        {
+          line = line.substr (0, line.find ('#'));
+          std::replace (line.begin (), line.end (), ',', ' ');
+          std::istringstream fields (line);
+          uint64_t imsi;
+          while (fields >> imsi)
+            {
+              m_imsis.insert (imsi);
+            }
+          NS_ABORT_MSG_UNLESS (fields.eof (), "Malformed IMSI list " << imsiFile << ": " << line);
+        }
+    }
+
+  // CE level thresholds: coupling loss grows with the level, SNR decreases
+  m_thresholds[0] = m_mode == SNR ? 0 : 144;
+  m_thresholds[1] = m_mode == SNR ? -10 : 154;
+  if (!thresholds.empty ())
+    {
+      std::replace (thresholds.begin (), thresholds.end (), ':', ' ');
+      std::istringstream fields (thresholds);
+      fields >> m_thresholds[0] >> m_thresholds[1];
+      NS_ABORT_MSG_IF (fields.fail (), "ceThresholds needs two values");
+    }
+
+  std::replace (repetitions.begin (), repetitions.end (), ':', ' ');
+  std::istringstream fields (repetitions);
+  fields >> m_repetitions[0] >> m_repetitions[1] >> m_repetitions[2];
+  NS_ABORT_MSG_IF (fields.fail (), "ceRepetitions needs three values");
+}
+
+bool
+RepetitionPolicy::NeedsCouplingLoss () const
+{
+  return m_mode == COUPLING || m_mode == SNR;
+}
+
+uint32_t
+RepetitionPolicy::GetCeLevel (uint64_t imsi, char trafficClass, double couplingLossDb, const CellConfig &servingCell) const
+{
+  if (m_classes.find (trafficClass) == std::string::npos)
+    {
+      return 0;
+    }
+  switch (m_mode)
+    {
+    case LIST:
+      return m_imsis.count (imsi) ? 2 : 0;
+    case COUPLING:
+      return (couplingLossDb > m_thresholds[0]) + (couplingLossDb > m_thresholds[1]);
+    case SNR:
+      {
+        // UE at 23 dBm over the cell's UL bandwidth, eNB noise figure 5 dB
+        double noiseDbm = -174 + 10 * std::log10 (servingCell.ulBandwidth * 180e3) + 5;
+        double snrDb = 23.0 - couplingLossDb - noiseDbm;
+        return (snrDb < m_thresholds[0]) + (snrDb < m_thresholds[1]);
+      }
+    default:
+      return 0;
+    }
+}
+
+uint32_t
+RepetitionPolicy::GetRepetitions (uint32_t ceLevel) const
+{
+  return m_repetitions[std::min<uint32_t> (ceLevel, 2)];
+}
+
+ProvisioningLog::ProvisioningLog (std::string file, std::string format, uint32_t verbosity)
+  : m_binary (format == "binary"),
+    m_verbosity (verbosity)
+{
+  NS_ABORT_MSG_UNLESS (format == "csv" || format == "binary", "Unknown provisioning log format: " << format);
+  if (!file.empty ())
+    {
+      m_file.open (file.c_str (), std::ios::out | std::ios::binary | std::ios::trunc);
+      NS_ABORT_MSG_UNLESS (m_file.is_open (), "Cannot open provisioning log " << file);
+      if (m_binary)
+        {
+          m_buffer.append ("NBP1", 4);
+        }
+      else
+        {
+          m_buffer.append ("imsi,class,macroSector,macroDistance,smallCell,smallDistance,tier,ceLevel,repetition\n");
+        }
+    }
+}
+
+ProvisioningLog::~ProvisioningLog ()
+{
+  Close ();
+}
+
+void
+ProvisioningLog::Add (const ProvisioningRecord &r)
+{
+  uint32_t tier = r.useSmallCell ? 2 : 1;
+  if (m_file.is_open () && m_binary)
+    {
+      // imsi u64, macro/small cell u32, distances f64, class, tier, CE level, repetition u8
+      char bytes[40];
+      uint8_t tail[4] = {uint8_t (r.trafficClass), uint8_t (tier), uint8_t (r.ceLevel), uint8_t (r.repetition)};
+      std::memcpy (bytes, &r.imsi, 8);
+      std::memcpy (bytes + 8, &r.macroCell, 4);
+      std::memcpy (bytes + 12, &r.smallCell, 4);
+      std::memcpy (bytes + 16, &r.macroDistance, 8);
+      std::memcpy (bytes + 24, &r.smallDistance, 8);
+      std::memcpy (bytes + 32, tail, 4);
+      std::memset (bytes + 36, 0, 4);
+      m_buffer.append (bytes, sizeof (bytes));
+    }
+  else if (m_file.is_open ())
+    {
+      std::ostringstream line;
+      line << r.imsi << ',' << r.trafficClass << ',' << r.macroCell + 1 << ',' << r.macroDistance << ','
+           << r.smallCell + 1 << ',' << r.smallDistance << ',' << tier << ',' << r.ceLevel << ','
+           << r.repetition << '\n';
+      m_buffer.append (line.str ());
+    }
+
+  if (m_verbosity > 0)
+    {
+      std::ostringstream text;
+      if (m_verbosity > 1)
+        {
+          text << "dist1: " << r.macroDistance << ", y dist2: " << r.smallDistance << '\n';
+          if (r.useSmallCell)
+            text << "Indoor closest and in range\n";
+          else if (r.smallDistance < r.macroDistance)
+            text << "Outdoor, closer to Indoor but not enough\n";
+          else
+            text << "Outdoor closest\n";
+        }
+      text << r.imsi << ", " << r.macroCell + 1 << ", " << r.trafficClass << ", " << r.macroDistance << ", "
+           << (r.repetition ? "YESrepeat" : "NOrepeat") << '\n';
+      m_text.append (text.str ());
+    }
+
+  if (m_buffer.size () + m_text.size () >= (1 << 16))
+    {
+      Flush ();
+    }
+}
+
+void
+ProvisioningLog::Flush ()
+{
+  if (!m_buffer.empty ())
+    {
+      m_file.write (m_buffer.data (), m_buffer.size ());
+      m_buffer.clear ();
+    }
+  if (!m_text.empty ())
+    {
+      std::cout.write (m_text.data (), m_text.size ());
+      m_text.clear ();
+    }
+}
+
+void
+ProvisioningLog::Close ()
+{
+  Flush ();
+  std::cout.flush ();
+  if (m_file.is_open ())
+    {
+      m_file.close ();
+    }
+}
+
+ColumnarTable::ColumnarTable (std::string file, bool perCell, const std::vector<std::string> &metrics)
+  : m_values (metrics.size ())
+{
+  m_file.open (file.c_str (), std::ios::out | std::ios::binary | std::ios::trunc);
+  NS_ABORT_MSG_UNLESS (m_file.is_open (), "Cannot open trace file " << file);
+  uint8_t keyKind = perCell;
+  uint32_t n = metrics.size ();
+  m_file.write ("NBC1", 4);
+  m_file.write (reinterpret_cast<const char *> (&keyKind), 1);
+  m_file.write (reinterpret_cast<const char *> (&n), 4);
+  for (uint32_t i = 0; i < n; ++i)
+    {
+      uint8_t length = metrics[i].size ();
+      m_file.write (reinterpret_cast<const char *> (&length), 1);
+      m_file.write (metrics[i].data (), length);
+    }
+}
+
+void
+ColumnarTable::Add (uint32_t timeMs, uint32_t ue, uint16_t cell, uint32_t count, const double *values)
+{
+  m_time.push_back (timeMs);
+  m_ue.push_back (ue);
+  m_cell.push_back (cell);
+  m_count.push_back (count);
+  for (uint32_t i = 0; i < m_values.size (); ++i)
+    {
+      m_values[i].push_back (values[i]);
+    }
+  if (m_time.size () >= 4096)
+    {
+      FlushBlock ();
+    }
+}
+
+template <class T>
+static void
+WriteColumn (std::ofstream &file, std::vector<T> &column)
+{
+  file.write (reinterpret_cast<const char *> (column.data ()), column.size () * sizeof (T));
+  column.clear ();
+}
+
+void
+ColumnarTable::FlushBlock ()
+{
+  uint32_t rows = m_time.size ();
+  if (rows == 0)
+    {
+      return;
+    }
+  m_file.write (reinterpret_cast<const char *> (&rows), 4);
+  WriteColumn (m_file, m_time);
+  WriteColumn (m_file, m_ue);
+  WriteColumn (m_file, m_cell);
+  WriteColumn (m_file, m_count);
+  for (uint32_t i = 0; i < m_values.size (); ++i)
+    {
+      WriteColumn (m_file, m_values[i]);
+    }
+}
+
+void
+ColumnarTable::Close (const std::vector<uint64_t> &imsis, const std::vector<uint16_t> &cellIds)
+{
+  if (!m_file.is_open ())
+    {
+      return;
+    }
+  FlushBlock ();
+  uint32_t marker = 0xffffffff;
+  uint32_t n = imsis.size ();
+  m_file.write (reinterpret_cast<const char *> (&marker), 4);
+  m_file.write (reinterpret_cast<const char *> (&n), 4);
+  m_file.write (reinterpret_cast<const char *> (imsis.data ()), n * sizeof (uint64_t));
+  n = cellIds.size ();
+  m_file.write (reinterpret_cast<const char *> (&n), 4);
+  m_file.write (reinterpret_cast<const char *> (cellIds.data ()), n * sizeof (uint16_t));
+  m_file.close ();
+}
+
+static const char *g_layerNames[] = {"phy-dl", "phy-ul", "mac-dl", "mac-ul"};
+static const char *g_layerFiles[] = {"DlRsrpSinrStats", "UlSinrStats", "DlMacStats", "UlMacStats"};
+// Metrics of each layer; a '+' prefix marks a metric summed over the window
+static const char *g_layerMetrics[][2] = {{"rsrp", "sinr"}, {"sinr", 0}, {"mcs", "+bytes"}, {"mcs", "+bytes"}};
+
+TraceRecorder::TraceRecorder (std::string spec, std::string format, double window, std::string key, std::string tag)
+  : m_columnar (format == "columnar"),
+    m_perCell (key == "cell"),
+    m_window (window),
+    m_tag (tag),
+    m_rlc (false),
+    m_pdcp (false)
+{
+  NS_ABORT_MSG_UNLESS (format == "columnar" || format == "text", "Unknown trace format: " << format);
+  NS_ABORT_MSG_UNLESS (key == "ue" || key == "cell", "Unknown trace key: " << key);
+  NS_ABORT_MSG_IF (window < 0, "Negative trace window");
+  for (uint32_t l = 0; l < N_COLUMNAR_LAYERS; ++l)
+    {
+      m_layers[l].enabled = false;
+      m_layers[l].table = 0;
+    }
+
+  std::replace (spec.begin (), spec.end (), ',', ' ');
+  std::istringstream entries (spec);
+  std::string entry;
+  while (entries >> entry)
+    {
+      std::string layer = entry.substr (0, entry.find (':'));
+      std::string metrics = entry.find (':') == std::string::npos ? "" : entry.substr (entry.find (':') + 1);
+      if (layer == "rlc" || layer == "pdcp")
+        {
+          NS_ABORT_MSG_UNLESS (metrics.empty (), "No metric selection for " << layer);
+          (layer == "rlc" ? m_rlc : m_pdcp) = true;
+          continue;
+        }
+      uint32_t l = std::find (g_layerNames, g_layerNames + N_COLUMNAR_LAYERS, layer) - g_layerNames;
+      NS_ABORT_MSG_IF (l == N_COLUMNAR_LAYERS, "Unknown trace layer: " << layer);
+      LayerTrace &trace = m_layers[l];
+      trace.enabled = true;
+      for (uint32_t m = 0; m < 2 && g_layerMetrics[l][m]; ++m)
+        {
+          std::string name = g_layerMetrics[l][m];
+          name = name[0] == '+' ? name.substr (1) : name;
+          if (metrics.empty () || ("+" + metrics + "+").find ("+" + name + "+") != std::string::npos)
+            {
+              trace.metrics.push_back (m);
+            }
+        }
+      NS_ABORT_MSG_IF (trace.metrics.empty (), "No known metric in " << entry);
+    }
+
+  // The module's own calculators, used in text format
+  Config::SetDefault ("ns3::PhyStatsCalculator::DlRsrpSinrFilename", StringValue ("DlRsrpSinrStats" + tag + ".txt"));
+  Config::SetDefault ("ns3::PhyStatsCalculator::UlSinrFilename", StringValue ("UlSinrStats" + tag + ".txt"));
+  Config::SetDefault ("ns3::PhyStatsCalculator::UlInterferenceFilename", StringValue ("UlInterferenceStats" + tag + ".txt"));
+  Config::SetDefault ("ns3::MacStatsCalculator::DlOutputFilename", StringValue ("DlMacStats" + tag + ".txt"));
+  Config::SetDefault ("ns3::MacStatsCalculator::UlOutputFilename", StringValue ("UlMacStats" + tag + ".txt"));
+}
+
+void
+TraceRecorder::SetTag (std::string tag)
+{
+  bool textPhyMac = false;
+  for (uint32_t l = 0; l < N_COLUMNAR_LAYERS; ++l)
+    {
+      textPhyMac |= !m_columnar && m_layers[l].enabled;
+    }
+  NS_ABORT_MSG_IF (textPhyMac && tag != m_tag, "Text PHY/MAC trace files cannot be renamed, use the columnar format");
+  m_tag = tag;
+}
+
+void
+TraceRecorder::SkipUnusedPhySampling () const
+{
+  // These periods only pace the PHY trace sources; CQI and the RRC
+  // measurements have their own. Must precede the device install.
+  if (!m_layers[PHY_DL].enabled)
+    {
+      Config::SetDefault ("ns3::LteUePhy::RsrpSinrSamplePeriod", UintegerValue (65535));
+    }
+  if (!m_layers[PHY_UL].enabled)
+    {
+      Config::SetDefault ("ns3::LteEnbPhy::UeSinrSamplePeriod", UintegerValue (65535));
+      Config::SetDefault ("ns3::LteEnbPhy::InterferenceSamplePeriod", UintegerValue (65535));
+    }
+}
+
+void
+TraceRecorder::Install (Ptr<LteHelper> lteHelper, NetDeviceContainer macroDevs, NetDeviceContainer smallDevs,
+                        const std::vector<NetDeviceContainer> &ueDevs)
+{
+  if (m_rlc)
+    {
+      lteHelper->EnableRlcTraces ();
+      Ptr<RadioBearerStatsCalculator> stats = lteHelper->GetRlcStats ();
+      stats->SetAttribute ("DlRlcOutputFilename", StringValue ("DlRlcStats" + m_tag + ".txt"));
+      stats->SetAttribute ("UlRlcOutputFilename", StringValue ("UlRlcStats" + m_tag + ".txt"));
+      if (m_window > 0)
+        {
+          stats->SetAttribute ("EpochDuration", TimeValue (Seconds (m_window)));
+        }
+    }
+  if (m_pdcp)
+    {
+      lteHelper->EnablePdcpTraces ();
+      Ptr<RadioBearerStatsCalculator> stats = lteHelper->GetPdcpStats ();
+      stats->SetAttribute ("DlPdcpOutputFilename", StringValue ("DlPdcpStats" + m_tag + ".txt"));
+      stats->SetAttribute ("UlPdcpOutputFilename", StringValue ("UlPdcpStats" + m_tag + ".txt"));
+      if (m_window > 0)
+        {
+          stats->SetAttribute ("EpochDuration", TimeValue (Seconds (m_window)));
+        }
+    }
+
+  if (!m_columnar)
+    {
+      if (m_layers[PHY_DL].enabled)
+        lteHelper->EnableDlPhyTraces ();
+      if (m_layers[PHY_UL].enabled)
+        lteHelper->EnableUlPhyTraces ();
+      if (m_layers[MAC_DL].enabled)
+        lteHelper->EnableDlMacTraces ();
+      if (m_layers[MAC_UL].enabled)
+        lteHelper->EnableUlMacTraces ();
+      return;
+    }
+
+  bool any = false;
+  for (uint32_t l = 0; l < N_COLUMNAR_LAYERS; ++l)
+    {
+      if (!m_layers[l].enabled)
+        {
+          continue;
+        }
+      any = true;
+      std::vector<std::string> names;
+      for (uint32_t i = 0; i < m_layers[l].metrics.size (); ++i)
+        {
+          std::string name = g_layerMetrics[l][m_layers[l].metrics[i]];
+          names.push_back (name[0] == '+' ? name.substr (1) : name);
+        }
+      m_layers[l].table = new ColumnarTable (g_layerFiles[l] + m_tag + ".nbc", m_perCell, names);
+    }
+  if (!any)
+    {
+      return;
+    }
+
+  // Taps are addressed by the callbacks, so the vectors must not reallocate
+  NetDeviceContainer cellDevs (macroDevs, smallDevs);
+  m_cellTaps.reserve (cellDevs.GetN ());
+  for (uint32_t i = 0; i < cellDevs.GetN (); ++i)
+    {
+      Ptr<LteEnbNetDevice> enb = cellDevs.Get (i)->GetObject<LteEnbNetDevice> ();
+      m_cellIds.push_back (enb->GetCellId ());
+      CellTap tap = {this, uint16_t (i)};
+      m_cellTaps.push_back (tap);
+      CellTap *t = &m_cellTaps.back ();
+      if (m_layers[PHY_UL].enabled)
+        enb->GetPhy ()->TraceConnectWithoutContext ("ReportUeSinr", MakeCallback (&CellTap::UlSinr, t));
+      if (m_layers[MAC_DL].enabled)
+        enb->GetMac ()->TraceConnectWithoutContext ("DlScheduling", MakeCallback (&CellTap::DlScheduling, t));
+      if (m_layers[MAC_UL].enabled)
+        enb->GetMac ()->TraceConnectWithoutContext ("UlScheduling", MakeCallback (&CellTap::UlScheduling, t));
+    }
+
+  uint32_t nUes = 0;
+  for (uint32_t c = 0; c < ueDevs.size (); ++c)
+    {
+      nUes += ueDevs[c].GetN ();
+    }
+  m_ueTaps.reserve (nUes);
+  for (uint32_t c = 0; c < ueDevs.size (); ++c)
+    {
+      for (uint32_t i = 0; i < ueDevs[c].GetN (); ++i)
+        {
+          Ptr<LteUeNetDevice> ue = ueDevs[c].Get (i)->GetObject<LteUeNetDevice> ();
+          UeTap tap = {this, uint32_t (m_imsis.size ())};
+          m_imsis.push_back (ue->GetImsi ());
+          m_ueTaps.push_back (tap);
+          UeTap *t = &m_ueTaps.back ();
+          Ptr<LteUeRrc> rrc = ue->GetRrc ();
+          rrc->TraceConnectWithoutContext ("ConnectionEstablished", MakeCallback (&UeTap::ConnectionEstablished, t));
+          // Connections made before the install, e.g. during warm-up
+          if (rrc->GetRnti () != 0)
+            {
+              t->ConnectionEstablished (ue->GetImsi (), rrc->GetCellId (), rrc->GetRnti ());
+            }
+          if (m_layers[PHY_DL].enabled)
+            ue->GetPhy ()->TraceConnectWithoutContext ("ReportCurrentCellRsrpSinr", MakeCallback (&UeTap::RsrpSinr, t));
+        }
+    }
+
+  if (m_window > 0)
+    {
+      Simulator::Schedule (Seconds (m_window), &TraceRecorder::EndWindow, this);
+    }
+}
+
+uint32_t
+TraceRecorder::UeOf (uint16_t cell, uint16_t rnti) const
+{
+  std::unordered_map<uint32_t, uint32_t>::const_iterator it = m_rntiToUe.find (uint32_t (cell) << 16 | rnti);
+  return it == m_rntiToUe.end () ? std::numeric_limits<uint32_t>::max () : it->second;
+}
+
+void
+TraceRecorder::Record (Layer layer, uint32_t ue, uint16_t cell, double v0, double v1)
+{
+  LayerTrace &trace = m_layers[layer];
+  double values[2] = {v0, v1};
+  if (m_window <= 0)
+    {
+      double selected[2];
+      for (uint32_t i = 0; i < trace.metrics.size (); ++i)
+        {
+          selected[i] = values[trace.metrics[i]];
+        }
+      trace.table->Add (Simulator::Now ().GetMilliSeconds (), ue, cell, 1, selected);
+      return;
+    }
+
+  uint64_t key = m_perCell ? cell : (uint64_t (ue) << 16 | cell);
+  Accumulator &acc = trace.window[key];
+  if (acc.count == 0)
+    {
+      acc.ue = m_perCell ? std::numeric_limits<uint32_t>::max () : ue;
+      acc.cell = cell;
+      acc.sums[0] = acc.sums[1] = 0;
+    }
+  ++acc.count;
+  acc.sums[0] += v0;
+  acc.sums[1] += v1;
+}
+
+void
+TraceRecorder::EndWindow ()
+{
+  uint32_t startMs = (Simulator::Now () - Seconds (m_window)).GetMilliSeconds ();
+  for (uint32_t l = 0; l < N_COLUMNAR_LAYERS; ++l)
+    {
+      LayerTrace &trace = m_layers[l];
+      if (!trace.enabled)
+        {
+          continue;
+        }
+      // Only the keys that saw an event in this window are visited
+      for (std::unordered_map<uint64_t, Accumulator>::iterator it = trace.window.begin (); it != trace.window.end (); ++it)
+        {
+          const Accumulator &acc = it->second;
+          double selected[2];
+          for (uint32_t i = 0; i < trace.metrics.size (); ++i)
+            {
+              uint32_t m = trace.metrics[i];
+              bool sum = g_layerMetrics[l][m][0] == '+';
+              selected[i] = sum ? acc.sums[m] : acc.sums[m] / acc.count;
+            }
+          trace.table->Add (startMs, acc.ue, acc.cell, acc.count, selected);
+        }
+      trace.window.clear ();
+    }
+  Simulator::Schedule (Seconds (m_window), &TraceRecorder::EndWindow, this);
+}
+
+void
+TraceRecorder::Close ()
+{
+  for (uint32_t l = 0; l < N_COLUMNAR_LAYERS; ++l)
+    {
+      if (m_layers[l].table)
+        {
+          m_layers[l].table->Close (m_imsis, m_cellIds);
+          delete m_layers[l].table;
+          m_layers[l].table = 0;
+        }
+    }
+}
+
+void
+TraceRecorder::UeTap::ConnectionEstablished (uint64_t, uint16_t cellId, uint16_t rnti)
+{
+  std::vector<uint16_t> &cellIds = recorder->m_cellIds;
+  uint32_t cell = std::find (cellIds.begin (), cellIds.end (), cellId) - cellIds.begin ();
+  recorder->m_rntiToUe[cell << 16 | rnti] = ue;
+}
+
+void
+TraceRecorder::UeTap::RsrpSinr (uint16_t cellId, uint16_t, double rsrp, double sinr)
+{
+  std::vector<uint16_t> &cellIds = recorder->m_cellIds;
+  uint16_t cell = std::find (cellIds.begin (), cellIds.end (), cellId) - cellIds.begin ();
+  recorder->Record (PHY_DL, ue, cell, 10 * std::log10 (rsrp) + 30, 10 * std::log10 (sinr));
+}
+
+void
+TraceRecorder::CellTap::UlSinr (uint16_t, uint16_t rnti, double sinr)
+{
+  recorder->Record (PHY_UL, recorder->UeOf (cell, rnti), cell, 10 * std::log10 (sinr), 0);
+}
+
+void
+TraceRecorder::CellTap::DlScheduling (uint32_t, uint32_t, uint16_t rnti, uint8_t mcs1, uint16_t size1, uint8_t, uint16_t size2)
+{
+  recorder->Record (MAC_DL, recorder->UeOf (cell, rnti), cell, mcs1, size1 + size2);
+}
+
+void
+TraceRecorder::CellTap::UlScheduling (uint32_t, uint32_t, uint16_t rnti, uint8_t mcs, uint16_t size)
+{
+  recorder->Record (MAC_UL, recorder->UeOf (cell, rnti), cell, mcs, size);
+}
+
+NS_OBJECT_ENSURE_REGISTERED (UplinkCollector);
+
+TypeId
+UplinkCollector::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::UplinkCollector")
+    .SetParent<Application> ()
+    .AddConstructor<UplinkCollector> ()
+    .AddAttribute ("Port", "UDP port all UEs send to",
+                   UintegerValue (2000),
+                   MakeUintegerAccessor (&UplinkCollector::m_port),
+                   MakeUintegerChecker<uint16_t> ())
+  ;
+  return tid;
+}
+
+UplinkCollector::UplinkCollector ()
+  : m_port (2000),
+    m_unknown (0)
+{
+}
+
+void
+UplinkCollector::AddUe (Ipv4Address address, uint64_t imsi)
+{
+  m_imsiOf[address.Get ()] = imsi;
+  if (imsi >= m_ues.size ())
+    {
+      UeCounters zero = {0, 0, 0, 0, 0, 0, 0};
+      m_ues.resize (imsi + 1, zero);
+    }
+}
+
+void
+UplinkCollector::StartApplication (void)
+{
+  m_socket = Socket::CreateSocket (GetNode (), UdpSocketFactory::GetTypeId ());
+  NS_ABORT_MSG_IF (m_socket->Bind (InetSocketAddress (Ipv4Address::GetAny (), m_port)) == -1,
+                   "Cannot bind the uplink collector to port " << m_port);
+  m_socket->SetRecvCallback (MakeCallback (&UplinkCollector::HandleRead, this));
+}
+
+void
+UplinkCollector::StopApplication (void)
+{
+  if (m_socket)
+    {
+      m_socket->Close ();
+      m_socket->SetRecvCallback (MakeNullCallback<void, Ptr<Socket> > ());
+    }
+}
+
+void
+UplinkCollector::HandleRead (Ptr<Socket> socket)
+{
+  Ptr<Packet> packet;
+  Address from;
+  while ((packet = socket->RecvFrom (from)))
+    {
+      std::unordered_map<uint32_t, uint64_t>::const_iterator it =
+        m_imsiOf.find (InetSocketAddress::ConvertFrom (from).GetIpv4 ().Get ());
+      if (it == m_imsiOf.end () || packet->GetSize () < SeqTsHeader ().GetSerializedSize ())
+        {
+          ++m_unknown;
+          continue;
+        }
+      UeCounters &ue = m_ues[it->second];
+      SeqTsHeader header;
+      packet->PeekHeader (header);
+      uint32_t seq = header.GetSeq ();
+
+      ++ue.rxPackets;
+      ue.rxBytes += packet->GetSize ();
+      if (seq >= ue.nextSeq)
+        {
+          ue.lost += seq - ue.nextSeq;
+          ue.nextSeq = seq + 1;
+        }
+      else
+        {
+          // Late arrival of a packet already counted as lost
+          ++ue.reordered;
+          ue.lost -= ue.lost > 0;
+        }
+      int64_t latency = (Simulator::Now () - header.GetTs ()).GetNanoSeconds ();
+      ue.latencySum += latency;
+      ue.latencyMax = std::max (ue.latencyMax, latency);
+      for (uint32_t i = 0; i < m_rx.size (); ++i)
+        {
+          m_rx[i] (it->second, packet);
+        }
+    }
+}
+
+void
+UplinkCollector::AddRxCallback (Callback<void, uint64_t, Ptr<const Packet> > rx)
+{
+  m_rx.push_back (rx);
+}
+
+void
+UplinkCollector::GetTotals (uint64_t &rxPackets, uint64_t &lost, double &meanLatencyMs) const
+{
+  rxPackets = 0;
+  lost = 0;
+  double latencySum = 0;
+  for (uint32_t i = 0; i < m_ues.size (); ++i)
+    {
+      rxPackets += m_ues[i].rxPackets;
+      lost += m_ues[i].lost;
+      latencySum += m_ues[i].latencySum;
+    }
+  meanLatencyMs = rxPackets > 0 ? latencySum / 1e6 / rxPackets : 0;
+}
+
+void
+UplinkCollector::Report (std::string file) const
+{
+  std::ofstream out (file.c_str ());
+  NS_ABORT_MSG_UNLESS (out.is_open (), "Cannot open " << file);
+  out << "imsi,rxPackets,rxBytes,lost,reordered,meanLatencyMs,maxLatencyMs\n";
+  for (uint64_t imsi = 0; imsi < m_ues.size (); ++imsi)
+    {
+      const UeCounters &ue = m_ues[imsi];
+      if (ue.rxPackets == 0)
+        {
+          continue;
+        }
+      out << imsi << ',' << ue.rxPackets << ',' << ue.rxBytes << ',' << ue.lost << ',' << ue.reordered << ','
+          << ue.latencySum / 1e6 / ue.rxPackets << ',' << ue.latencyMax / 1e6 << '\n';
+    }
+  if (m_unknown > 0)
+    {
+      out << "# " << m_unknown << " packets from unknown sources\n";
+    }
+}
+
+FlowReporter::FlowReporter (std::string file, double interval)
+  : m_enabled (interval > 0),
+    m_interval (Seconds (interval)),
+    m_last (Seconds (0))
+{
+  if (!m_enabled)
+    {
+      return;
+    }
+  m_file.open (file.c_str ());
+  NS_ABORT_MSG_UNLESS (m_file.is_open (), "Cannot open " << file);
+  m_file << "time,direction,class,cellId,rxPackets,rxBytes,throughputKbps,lost,latencyP50Ms,latencyP95Ms,latencyP99Ms\n";
+  Simulator::Schedule (m_interval, &FlowReporter::Report, this);
+}
+
+uint32_t
+FlowReporter::GroupOf (bool uplink, char trafficClass, uint16_t cellId)
+{
+  uint32_t key = uint32_t (uplink) << 24 | uint32_t (uint8_t (trafficClass)) << 16 | cellId;
+  std::map<uint32_t, uint32_t>::iterator it = m_groupOf.find (key);
+  if (it != m_groupOf.end ())
+    {
+      return it->second;
+    }
+  Group group;
+  group.uplink = uplink;
+  group.trafficClass = trafficClass;
+  group.cellId = cellId;
+  group.dirty = false;
+  group.rxPackets = 0;
+  group.rxBytes = 0;
+  group.lost = 0;
+  group.latency.assign (LATENCY_BINS, 0);
+  m_groups.push_back (group);
+  m_groupOf[key] = m_groups.size () - 1;
+  return m_groups.size () - 1;
+}
+
+void
+FlowReporter::AddDownlinkFlow (Ptr<Application> sink, char trafficClass, uint16_t cellId)
+{
+  Flow flow = {this, GroupOf (false, trafficClass, cellId), 0};
+  m_flows.push_back (flow);
+  sink->TraceConnectWithoutContext ("Rx", MakeCallback (&Flow::SinkRx, &m_flows.back ()));
+}
+
+void
+FlowReporter::AddUplinkFlow (uint64_t imsi, char trafficClass, uint16_t cellId)
+{
+  Flow flow = {this, GroupOf (true, trafficClass, cellId), 0};
+  m_flows.push_back (flow);
+  if (imsi >= m_ulFlowOfImsi.size ())
+    {
+      m_ulFlowOfImsi.resize (imsi + 1, 0);
+    }
+  m_ulFlowOfImsi[imsi] = m_flows.size ();
+}
+
+void
+FlowReporter::Flow::SinkRx (Ptr<const Packet> packet, const Address &)
+{
+  reporter->Receive (*this, packet);
+}
+
+void
+FlowReporter::UplinkRx (uint64_t imsi, Ptr<const Packet> packet)
+{
+  if (imsi < m_ulFlowOfImsi.size () && m_ulFlowOfImsi[imsi] > 0)
+    {
+      Receive (m_flows[m_ulFlowOfImsi[imsi] - 1], packet);
+    }
+}
+
+void
+FlowReporter::Receive (Flow &flow, Ptr<const Packet> packet)
+{
+  if (packet->GetSize () < SeqTsHeader ().GetSerializedSize ())
+    {
+      return;
+    }
+  SeqTsHeader header;
+  packet->PeekHeader (header);
+  Group &group = m_groups[flow.group];
+  if (!group.dirty)
+    {
+      group.dirty = true;
+      m_dirty.push_back (flow.group);
+    }
+  ++group.rxPackets;
+  group.rxBytes += packet->GetSize ();
+  if (header.GetSeq () >= flow.nextSeq)
+    {
+      group.lost += header.GetSeq () - flow.nextSeq;
+      flow.nextSeq = header.GetSeq () + 1;
+    }
+
+  int64_t us = std::max<int64_t> (1, (Simulator::Now () - header.GetTs ()).GetMicroSeconds ());
+  uint32_t bin = std::min<uint32_t> (LATENCY_BINS - 1, 8 * std::log2 (double (us)));
+  ++group.latency[bin];
+}
+
+double
+FlowReporter::Percentile (const Group &group, double p) const
+{
+  uint32_t rank = std::ceil (p * group.rxPackets);
+  uint32_t seen = 0;
+  for (uint32_t bin = 0; bin < LATENCY_BINS; ++bin)
+    {
+      seen += group.latency[bin];
+      if (seen >= rank && seen > 0)
+        {
+          // Geometric centre of the bin, in ms
+          return std::pow (2.0, (bin + 0.5) / 8) / 1000;
+        }
+    }
+  return 0;
+}
+
+void
+FlowReporter::Report ()
+{
+  Time now = Simulator::Now ();
+  double seconds = (now - m_last).GetSeconds ();
+  std::ostringstream lines;
+  for (uint32_t i = 0; i < m_dirty.size (); ++i)
+    {
+      Group &group = m_groups[m_dirty[i]];
+      lines << now.GetSeconds () << ',' << (group.uplink ? "UL" : "DL") << ',' << group.trafficClass << ','
+            << group.cellId << ',' << group.rxPackets << ',' << group.rxBytes << ','
+            << (seconds > 0 ? group.rxBytes * 8 / seconds / 1000 : 0) << ',' << group.lost << ','
+            << Percentile (group, 0.5) << ',' << Percentile (group, 0.95) << ',' << Percentile (group, 0.99) << '\n';
+      group.dirty = false;
+      group.rxPackets = 0;
+      group.rxBytes = 0;
+      group.lost = 0;
+      std::fill (group.latency.begin (), group.latency.end (), 0);
+    }
+  m_dirty.clear ();
+  m_file << lines.str ();
+  m_last = now;
+  if (!Simulator::IsFinished ())
+    {
+      Simulator::Schedule (m_interval, &FlowReporter::Report, this);
+    }
+}
+
+void
+FlowReporter::Close ()
+{
+  if (m_enabled && m_file.is_open ())
+    {
+      // Whatever the last, partial interval received
+      Report ();
+      m_file.close ();
+    }
+}
+
+int
+RunSweep (const char *program, const std::vector<std::string> &baseArgs, std::string grid,
+          uint32_t replications, uint32_t jobs, double memoryMb, double workerMb, std::string output)
+{
+  // Grid points: cartesian product of the values of every parameter
+  std::vector<std::string> names;
+  std::vector<std::vector<std::string> > values;
+  std::replace (grid.begin (), grid.end (), ';', ' ');
+  std::istringstream parameters (grid);
+  std::string parameter;
+  while (parameters >> parameter)
+    {
+      size_t eq = parameter.find ('=');
+      NS_ABORT_MSG_IF (eq == std::string::npos || eq + 1 == parameter.size (), "Malformed sweep parameter: " << parameter);
+      names.push_back (parameter.substr (0, eq));
+      std::string list = parameter.substr (eq + 1);
+      std::replace (list.begin (), list.end (), ',', ' ');
+      std::istringstream items (list);
+      values.push_back (std::vector<std::string> (std::istream_iterator<std::string> (items),
+                                                  std::istream_iterator<std::string> ()));
+    }
+  uint32_t nPoints = 1;
+  for (uint32_t p = 0; p < values.size (); ++p)
+    {
+      nPoints *= values[p].size ();
+    }
+
+  struct Run
+  {
+    uint32_t point;
+    std::vector<std::string> args;
+    std::string kpiFile;
+    bool ok;
+  };
+  std::vector<Run> runs;
+  for (uint32_t point = 0; point < nPoints; ++point)
+    {
+      for (uint32_t r = 1; r <= replications; ++r)
+        {
+          Run run;
+          run.point = point;
+          run.ok = false;
+          run.args = baseArgs;
+          for (uint32_t p = 0, rest = point; p < names.size (); rest /= values[p].size (), ++p)
+            {
+              run.args.push_back ("--" + names[p] + "=" + values[p][rest % values[p].size ()]);
+            }
+          std::ostringstream seed;
+          seed << r;
+          run.args.push_back ("--RngRun=" + seed.str ());
+          std::ostringstream kpiFile;
+          kpiFile << output << ".run" << runs.size () << ".kpi";
+          run.kpiFile = kpiFile.str ();
+          run.args.push_back ("--kpiFile=" + run.kpiFile);
+          // Output files named after the KPI file, so that runs sharing a
+          // seed do not count each other's files in outputBytes
+          std::string outputTag = "_" + run.kpiFile.substr (run.kpiFile.rfind ('/') + 1);
+          outputTag.resize (outputTag.size () - 4);    // ".kpi"
+          for (uint32_t c = 1; c < outputTag.size (); ++c)
+            {
+              if (!std::isalnum (static_cast<unsigned char> (outputTag[c])))
+                {
+                  outputTag[c] = '_';
+                }
+            }
+          run.args.push_back ("--outputTag=" + outputTag);
+          runs.push_back (run);
+        }
+    }
+
+  if (jobs == 0)
+    {
+      jobs = std::max (1u, std::thread::hardware_concurrency ());
+    }
+  double peakMb = 0;                       // largest worker peak RSS so far
+  std::map<pid_t, uint32_t> running;
+  uint32_t next = 0;
+  uint32_t failed = 0;
+  std::cout << "Sweep: " << runs.size () << " runs, up to " << jobs << " workers" << std::endl;
+  while (next < runs.size () || !running.empty ())
+    {
+      uint32_t allowed = jobs;
+      if (memoryMb > 0)
+        {
+          allowed = std::max (1u, std::min (jobs, uint32_t (memoryMb / (peakMb > 0 ? peakMb : workerMb))));
+        }
+      if (next < runs.size () && running.size () < allowed)
+        {
+          std::vector<char *> argv;
+          argv.push_back (const_cast<char *> (program));
+          for (uint32_t i = 0; i < runs[next].args.size (); ++i)
+            {
+              argv.push_back (const_cast<char *> (runs[next].args[i].c_str ()));
+            }
+          argv.push_back (0);
+          pid_t pid = fork ();
+          NS_ABORT_MSG_IF (pid < 0, "fork failed");
+          if (pid == 0)
+            {
+              // Workers keep stderr, their stdout would interleave
+              if (!std::freopen ("/dev/null", "w", stdout))
+                {
+                  _exit (127);
+                }
+              execv (program, &argv[0]);
+              _exit (127);
+            }
+          running[pid] = next++;
+          continue;
+        }
+
+      int status;
+      struct rusage usage;
+      pid_t pid = wait4 (-1, &status, 0, &usage);
+      NS_ABORT_MSG_IF (pid < 0, "wait4 failed");
+      Run &run = runs[running[pid]];
+      running.erase (pid);
+      run.ok = WIFEXITED (status) && WEXITSTATUS (status) == 0;
+      peakMb = std::max (peakMb, usage.ru_maxrss / 1024.0);   // ru_maxrss is in kB
+      if (!run.ok)
+        {
+          ++failed;
+          std::cerr << "Sweep run failed:";
+          for (uint32_t i = 0; i < run.args.size (); ++i)
+            {
+              std::cerr << " " << run.args[i];
+            }
+          std::cerr << std::endl;
+        }
+    }
+
+  // Merge: per grid point and KPI, all replications
+  std::vector<std::map<std::string, std::vector<double> > > kpis (nPoints);
+  std::vector<std::string> kpiNames;
+  for (uint32_t i = 0; i < runs.size (); ++i)
+    {
+      std::ifstream in (runs[i].kpiFile.c_str ());
+      std::string name;
+      double value;
+      while (runs[i].ok && in >> name >> value)
+        {
+          if (std::find (kpiNames.begin (), kpiNames.end (), name) == kpiNames.end ())
+            {
+              kpiNames.push_back (name);
+            }
+          kpis[runs[i].point][name].push_back (value);
+        }
+      std::remove (runs[i].kpiFile.c_str ());
+    }
+
+  // Student t quantiles (0.975) for 1..30 degrees of freedom, normal beyond
+  static const double t975[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+  std::ofstream out (output.c_str ());
+  NS_ABORT_MSG_UNLESS (out.is_open (), "Cannot open " << output);
+  for (uint32_t p = 0; p < names.size (); ++p)
+    {
+      out << names[p] << ",";
+    }
+  out << "runs";
+  for (uint32_t k = 0; k < kpiNames.size (); ++k)
+    {
+      out << "," << kpiNames[k] << "," << kpiNames[k] << "Ci95";
+    }
+  out << "\n";
+  for (uint32_t point = 0; point < nPoints; ++point)
+    {
+      for (uint32_t p = 0, rest = point; p < names.size (); rest /= values[p].size (), ++p)
+        {
+          out << values[p][rest % values[p].size ()] << ",";
+        }
+      out << (kpiNames.empty () ? 0 : kpis[point][kpiNames[0]].size ());
+      for (uint32_t k = 0; k < kpiNames.size (); ++k)
+        {
+          const std::vector<double> &samples = kpis[point][kpiNames[k]];
+          double n = samples.size ();
+          double mean = 0;
+          double var = 0;
+          for (uint32_t i = 0; i < samples.size (); ++i)
+            {
+              mean += samples[i] / n;
+            }
+          for (uint32_t i = 0; i < samples.size (); ++i)
+            {
+              var += (samples[i] - mean) * (samples[i] - mean) / (n - 1);
+            }
+          double t = n < 2 ? 0 : (n - 1 <= 30 ? t975[uint32_t (n) - 2] : 1.96);
+          out << "," << mean << "," << (n < 2 ? 0 : t * std::sqrt (var / n));
+        }
+      out << "\n";
+    }
+  std::cout << "Sweep: " << runs.size () - failed << " runs merged into " << output << std::endl;
+  return failed;
+}
+
+CouplingLossTable::CouplingLossTable (const std::vector<CellConfig> &cells, NodeContainer macroNodes,
+                                      NodeContainer smallNodes, NodeContainer ueNodes, double antennaLutResolution)
+  : m_model (antennaLutResolution),
+    m_cells (cells),
+    m_column (cells.size ())
+{
+  m_tierCells[0] = m_tierCells[1] = 0;
+  for (uint32_t i = 0; i < cells.size (); ++i)
+    {
+      uint32_t t = cells[i].tier - 1;
+      m_column[i] = m_tierCells[t]++;
+      Ptr<MobilityModel> mobility = (t == 0 ? macroNodes : smallNodes).Get (m_column[i])->GetObject<MobilityModel> ();
+      m_cellMobility.push_back (mobility);
+      m_cellOf[PeekPointer (mobility)] = i;
+      mobility->TraceConnectWithoutContext ("CourseChange", MakeCallback (&CouplingLossTable::CourseChanged, this));
+    }
+  for (uint32_t u = 0; u < ueNodes.GetN (); ++u)
+    {
+      Ptr<MobilityModel> mobility = ueNodes.Get (u)->GetObject<MobilityModel> ();
+      m_ueOf[PeekPointer (mobility)] = u;
+      mobility->TraceConnectWithoutContext ("CourseChange", MakeCallback (&CouplingLossTable::CourseChanged, this));
+    }
+  for (uint32_t t = 0; t < 2; ++t)
+    {
+      m_loss[t].assign (size_t (ueNodes.GetN ()) * m_tierCells[t], std::numeric_limits<float>::quiet_NaN ());
+    }
+}
+
+double
+CouplingLossTable::GetLossDb (Ptr<MobilityModel> a, Ptr<MobilityModel> b)
+{
+  // The channels pass the transmitter first: the cell on DL, the UE on UL
+  std::unordered_map<const MobilityModel *, uint32_t>::const_iterator cell = m_cellOf.find (PeekPointer (a));
+  Ptr<MobilityModel> ue = b;
+  bool downlink = cell != m_cellOf.end ();
+  if (!downlink)
+    {
+      cell = m_cellOf.find (PeekPointer (b));
+      ue = a;
+    }
+  NS_ABORT_MSG_IF (cell == m_cellOf.end (), "Coupling loss cache: link without an eNB end");
+  const CellConfig &config = m_cells[cell->second];
+  std::unordered_map<const MobilityModel *, uint32_t>::const_iterator row = m_ueOf.find (PeekPointer (ue));
+  if (row == m_ueOf.end ())
+    {
+      // Not one of the UEs the table was built for
+      return m_model.GetLossDb (config, m_cellMobility[cell->second], ue);
+    }
+
+  uint32_t t = config.tier - 1;
+  if (!m_ueCarrier.empty ())
+    {
+      uint32_t carrier = downlink ? m_ueCarrier[row->second].first : m_ueCarrier[row->second].second;
+      if (carrier != 0 && carrier != (downlink ? config.dlEarfcn : config.ulEarfcn))
+        {
+          return CROSS_CARRIER_LOSS_DB;
+        }
+    }
+  float &entry = m_loss[t][size_t (row->second) * m_tierCells[t] + m_column[cell->second]];
+  if (std::isnan (entry))
+    {
+      entry = m_model.GetLossDb (config, m_cellMobility[cell->second], ue);
+    }
+  return entry;
+}
+
+void
+CouplingLossTable::SetUeCarrier (Ptr<MobilityModel> ue, uint32_t dlEarfcn, uint32_t ulEarfcn)
+{
+  std::unordered_map<const MobilityModel *, uint32_t>::const_iterator row = m_ueOf.find (PeekPointer (ue));
+  NS_ABORT_MSG_IF (row == m_ueOf.end (), "Coupling loss cache: unknown UE");
+  if (m_ueCarrier.empty ())
+    {
+      m_ueCarrier.assign (m_ueOf.size (), std::make_pair (0u, 0u));
+    }
+  m_ueCarrier[row->second] = std::make_pair (dlEarfcn, ulEarfcn);
+}
+
+void
+CouplingLossTable::CourseChanged (Ptr<const MobilityModel> mobility)
+{
+  float nan = std::numeric_limits<float>::quiet_NaN ();
+  std::unordered_map<const MobilityModel *, uint32_t>::const_iterator it = m_ueOf.find (PeekPointer (mobility));
+  if (it != m_ueOf.end ())
+    {
+      for (uint32_t t = 0; t < 2; ++t)
+        {
+          std::fill_n (m_loss[t].begin () + size_t (it->second) * m_tierCells[t], m_tierCells[t], nan);
+        }
+      return;
+    }
+  it = m_cellOf.find (PeekPointer (mobility));
+  if (it != m_cellOf.end ())
+    {
+      uint32_t t = m_cells[it->second].tier - 1;
+      for (size_t i = m_column[it->second]; i < m_loss[t].size (); i += m_tierCells[t])
+        {
+          m_loss[t][i] = nan;
+        }
+    }
+}
+
+NS_OBJECT_ENSURE_REGISTERED (CachedCouplingLossModel);
+
+TypeId
+CachedCouplingLossModel::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::CachedCouplingLossModel")
+    .SetParent<PropagationLossModel> ()
+    .AddConstructor<CachedCouplingLossModel> ()
+  ;
+  return tid;
+}
+
+double
+CachedCouplingLossModel::DoCalcRxPower (double txPowerDbm, Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+{
+  NS_ABORT_MSG_UNLESS (g_couplingLossTable, "CachedCouplingLossModel used without a coupling loss table");
+  return txPowerDbm - g_couplingLossTable->GetLossDb (a, b);
+}
+
+int64_t
+CachedCouplingLossModel::DoAssignStreams (int64_t)
+{
+  return 0;
+}
+
+NS_OBJECT_ENSURE_REGISTERED (TabulatedCosineAntennaModel);
+
+TypeId
+TabulatedCosineAntennaModel::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::TabulatedCosineAntennaModel")
+    .SetParent<AntennaModel> ()
+    .AddConstructor<TabulatedCosineAntennaModel> ()
+    .AddAttribute ("Orientation", "Boresight azimuth [deg]",
+                   DoubleValue (0.0),
+                   MakeDoubleAccessor (&TabulatedCosineAntennaModel::m_orientation),
+                   MakeDoubleChecker<double> (-360, 360))
+    .AddAttribute ("Beamwidth", "3 dB beamwidth [deg]",
+                   DoubleValue (60),
+                   MakeDoubleAccessor (&TabulatedCosineAntennaModel::m_beamwidth),
+                   MakeDoubleChecker<double> (0, 180))
+    .AddAttribute ("MaxGain", "Gain at boresight [dB]",
+                   DoubleValue (0.0),
+                   MakeDoubleAccessor (&TabulatedCosineAntennaModel::m_maxGain),
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("Resolution", "Table step [deg]",
+                   DoubleValue (0.5),
+                   MakeDoubleAccessor (&TabulatedCosineAntennaModel::m_resolution),
+                   MakeDoubleChecker<double> (1e-3, 90))
+  ;
+  return tid;
+}
+
+TabulatedCosineAntennaModel::TabulatedCosineAntennaModel ()
+  : m_orientation (0),
+    m_beamwidth (60),
+    m_maxGain (0),
+    m_resolution (0.5),
+    m_table (0),
+    m_step (0)
+{
+}
+
+double
+TabulatedCosineAntennaModel::GetGainDb (Angles a)
+{
+  if (!m_table)
+    {
+      // Attributes are final by the first call; build or share the table
+      static std::map<std::pair<double, std::pair<double, double> >, std::vector<double> > tables;
+      std::vector<double> &table = tables[std::make_pair (m_beamwidth, std::make_pair (m_maxGain, m_resolution))];
+      uint32_t n = std::ceil (360.0 / m_resolution);
+      m_step = 2 * M_PI / n;
+      if (table.empty ())
+        {
+          // Same expression as CosineAntennaModel, floored where it goes to -inf at +-180 deg
+          double exponent = -3.0 / (20 * std::log10 (std::cos (m_beamwidth * M_PI / 180 / 4.0)));
+          for (uint32_t i = 0; i <= n; ++i)
+            {
+              double phi = -M_PI + i * m_step;
+              double gain = 20 * std::log10 (std::pow (std::cos (phi / 2), exponent)) + m_maxGain;
+              table.push_back (std::isfinite (gain) ? std::max (gain, m_maxGain - 300) : m_maxGain - 300);
+            }
+        }
+      m_table = &table;
+    }
+
+  double phi = a.phi - m_orientation * M_PI / 180;
+  while (phi <= -M_PI)
+    {
+      phi += 2 * M_PI;
+    }
+  while (phi > M_PI)
+    {
+      phi -= 2 * M_PI;
+    }
+  double x = (phi + M_PI) / m_step;
+  uint32_t i = std::min<uint32_t> (x, m_table->size () - 2);
+  double frac = x - i;
+  return (*m_table)[i] + frac * ((*m_table)[i + 1] - (*m_table)[i]);
+}
+
+int
+RunAntennaBenchmark (uint32_t samples, double resolution)
+{
+  std::vector<CellConfig> cells = DefaultTopology ();
+  std::vector<Ptr<AntennaModel> > analytic;
+  std::vector<Ptr<AntennaModel> > tabulated;
+  std::vector<double> peak;
+  for (uint32_t i = 0; i < cells.size (); ++i)
+    {
+      if (cells[i].beamwidth <= 0)
+        {
+          continue;
+        }
+      Ptr<AntennaModel> models[2];
+      const char *types[2] = {"ns3::CosineAntennaModel", "ns3::TabulatedCosineAntennaModel"};
+      for (uint32_t m = 0; m < 2; ++m)
+        {
+          ObjectFactory factory (types[m]);
+          factory.Set ("Orientation", DoubleValue (cells[i].azimuth));
+          factory.Set ("Beamwidth", DoubleValue (cells[i].beamwidth));
+          factory.Set ("MaxGain", DoubleValue (cells[i].maxGain));
+          if (m == 1)
+            {
+              factory.Set ("Resolution", DoubleValue (resolution));
+            }
+          models[m] = factory.Create<AntennaModel> ();
+        }
+      analytic.push_back (models[0]);
+      tabulated.push_back (models[1]);
+      peak.push_back (cells[i].maxGain);
+    }
+
+  Ptr<UniformRandomVariable> rv = CreateObject<UniformRandomVariable> ();
+  std::vector<Angles> angles (samples);
+  for (uint32_t k = 0; k < samples; ++k)
+    {
+      angles[k].phi = rv->GetValue (-M_PI, M_PI);
+      angles[k].theta = M_PI / 2;
+    }
+
+  double seconds[2];
+  double checksum[2];
+  std::vector<Ptr<AntennaModel> > *models[2] = {&analytic, &tabulated};
+  for (uint32_t m = 0; m < 2; ++m)
+    {
+      checksum[m] = 0;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+      for (uint32_t k = 0; k < samples; ++k)
+        {
+          double gain = (*models[m])[k % models[m]->size ()]->GetGainDb (angles[k]);
+          checksum[m] += std::isfinite (gain) ? gain : 0;
+        }
+      seconds[m] = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    }
+
+  // Error within 30 dB of the peak (the useful part of the pattern) and overall
+  double maxError30 = 0;
+  double maxError = 0;
+  for (uint32_t k = 0; k < samples; ++k)
+    {
+      uint32_t sector = k % analytic.size ();
+      double exact = analytic[sector]->GetGainDb (angles[k]);
+      if (!std::isfinite (exact))
+        {
+          continue;
+        }
+      double error = std::fabs (tabulated[sector]->GetGainDb (angles[k]) - exact);
+      maxError = std::max (maxError, error);
+      if (exact >= peak[sector] - 30)
+        {
+          maxError30 = std::max (maxError30, error);
+        }
+    }
+
+  std::cout << "Antenna gain, " << analytic.size () << " sectors, " << samples << " angles, table step "
+            << resolution << " deg" << std::endl;
+  std::cout << "analytic: " << seconds[0] / samples * 1e9 << " ns/call (checksum " << checksum[0] << ")" << std::endl;
+  std::cout << "table:    " << seconds[1] / samples * 1e9 << " ns/call (checksum " << checksum[1] << ")" << std::endl;
+  std::cout << "max error within 30 dB of peak: " << maxError30 << " dB, overall: " << maxError << " dB" << std::endl;
+  return 0;
+}
+
+size_t
+HeapInUse ()
+{
+#if defined (__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  return mallinfo2 ().uordblks;
+#elif defined (__GLIBC__)
+  return uint32_t (mallinfo ().uordblks);
+#else
+  return 0;
+#endif
+}
+
+int
+ForkVariants (uint32_t variants, uint32_t jobs, uint32_t &failed)
+{
+  if (jobs == 0)
+    {
+      jobs = std::max (1u, std::thread::hardware_concurrency ());
+    }
+  std::cout << std::flush;
+  failed = 0;
+  uint32_t running = 0;
+  for (uint32_t next = 0; next < variants || running > 0; )
+    {
+      if (next < variants && running < jobs)
+        {
+          pid_t pid = fork ();
+          NS_ABORT_MSG_IF (pid < 0, "fork failed");
+          if (pid == 0)
+            {
+              return next;
+            }
+          ++next;
+          ++running;
+          continue;
+        }
+      int status;
+      NS_ABORT_MSG_IF (wait (&status) < 0, "wait failed");
+      --running;
+      failed += !WIFEXITED (status) || WEXITSTATUS (status) != 0;
+    }
+  return -1;
+}
+
+PhaseProfiler::PhaseProfiler ()
+  : m_start (Take ()),
+    m_first (m_start)
+{
+}
+
+PhaseProfiler::Sample
+PhaseProfiler::Take ()
+{
+  Sample sample;
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  sample.wall = std::chrono::steady_clock::now ();
+  sample.cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+  sample.peakRss = usage.ru_maxrss;
+  sample.heap = HeapInUse ();
+  return sample;
+}
+
+void
+PhaseProfiler::Close ()
+{
+  Sample now = Take ();
+  if (!m_current.empty ())
+    {
+      Phase phase;
+      phase.name = m_current;
+      phase.wallSeconds = std::chrono::duration<double> (now.wall - m_start.wall).count ();
+      phase.cpuSeconds = now.cpu - m_start.cpu;
+      phase.peakRssDelta = now.peakRss - m_start.peakRss;
+      phase.heapDelta = double (now.heap) - m_start.heap;
+      phase.nodes = NodeList::GetNNodes ();
+      phase.devices = 0;
+      phase.applications = 0;
+      for (NodeList::Iterator it = NodeList::Begin (); it != NodeList::End (); ++it)
+        {
+          phase.devices += (*it)->GetNDevices ();
+          phase.applications += (*it)->GetNApplications ();
+        }
+      m_phases.push_back (phase);
+    }
+  m_start = now;
+}
+
+void
+PhaseProfiler::Mark (std::string phase)
+{
+  Close ();
+  m_current = phase;
+}
+
+void
+PhaseProfiler::Write (std::string file)
+{
+  Close ();
+  m_current.clear ();
+  std::ofstream out (file.c_str ());
+  NS_ABORT_MSG_UNLESS (out.is_open (), "Cannot open " << file);
+  out << "{\n  \"phases\": [\n";
+  for (uint32_t i = 0; i < m_phases.size (); ++i)
+    {
+      const Phase &p = m_phases[i];
+      out << "    {\"name\": \"" << p.name << "\", \"wallSeconds\": " << p.wallSeconds
+          << ", \"cpuSeconds\": " << p.cpuSeconds << ", \"peakRssDeltaKb\": " << p.peakRssDelta
+          << ", \"heapDeltaBytes\": " << p.heapDelta << ", \"nodes\": " << p.nodes
+          << ", \"devices\": " << p.devices << ", \"applications\": " << p.applications << "}"
+          << (i + 1 < m_phases.size () ? ",\n" : "\n");
+    }
+  out << "  ],\n  \"totalWallSeconds\": " << std::chrono::duration<double> (m_start.wall - m_first.wall).count ()
+      << ",\n  \"totalCpuSeconds\": " << m_start.cpu - m_first.cpu
+      << ",\n  \"peakRssKb\": " << m_start.peakRss << "\n}\n";
+}
+
+void
+CeLevelNotifier::AddCells (NetDeviceContainer enbDevs)
+{
+  for (uint32_t i = 0; i < enbDevs.GetN (); ++i)
+    {
+      Ptr<LteEnbNetDevice> enbDev = enbDevs.Get (i)->GetObject<LteEnbNetDevice> ();
+      PointerValue scheduler;
+      enbDev->GetAttribute ("FfMacScheduler", scheduler);
+      m_schedulers[enbDev->GetCellId ()] = DynamicCast<NbIotFfMacScheduler> (scheduler.Get<FfMacScheduler> ());
+    }
+}
+
+void
+CeLevelNotifier::SetCeLevel (uint64_t imsi, uint32_t ceLevel)
+{
+  m_ceLevels[imsi] = ceLevel;
+  Apply (imsi);
+}
+
+void
+CeLevelNotifier::ConnectionEstablished (uint64_t imsi, uint16_t cellId, uint16_t rnti)
+{
+  m_connections[imsi] = std::make_pair (cellId, rnti);
+  Apply (imsi);
+}
+
+void
+CeLevelNotifier::Apply (uint64_t imsi)
+{
+  std::unordered_map<uint64_t, uint32_t>::const_iterator level = m_ceLevels.find (imsi);
+  std::unordered_map<uint64_t, std::pair<uint16_t, uint16_t> >::const_iterator connection = m_connections.find (imsi);
+  if (level == m_ceLevels.end () || connection == m_connections.end ())
+    {
+      return;
+    }
+  std::unordered_map<uint16_t, Ptr<NbIotFfMacScheduler> >::const_iterator scheduler = m_schedulers.find (connection->second.first);
+  if (scheduler != m_schedulers.end () && scheduler->second)
+    {
+      scheduler->second->SetCeLevel (connection->second.second, level->second);
+    }
+}
+
+// SAP ends of the scheduler benchmark: count the DCIs, drop the rest
+class BenchmarkSchedUser : public FfMacSchedSapUser
+{
+public:
+  BenchmarkSchedUser ()
+    : dcis (0)
+  {
+  }
+  virtual void SchedDlConfigInd (const struct SchedDlConfigIndParameters &params)
+  {
+    dcis += params.m_buildDataList.size ();
+  }
+  virtual void SchedUlConfigInd (const struct SchedUlConfigIndParameters &params)
+  {
+    dcis += params.m_dciList.size ();
+  }
+
+  uint64_t dcis;
+};
+
+class BenchmarkCschedUser : public FfMacCschedSapUser
+{
+public:
+  virtual void CschedCellConfigCnf (const struct CschedCellConfigCnfParameters &)
+  {
+  }
+  virtual void CschedUeConfigCnf (const struct CschedUeConfigCnfParameters &)
+  {
+  }
+  virtual void CschedLcConfigCnf (const struct CschedLcConfigCnfParameters &)
+  {
+  }
+  virtual void CschedLcReleaseCnf (const struct CschedLcReleaseCnfParameters &)
+  {
+  }
+  virtual void CschedUeReleaseCnf (const struct CschedUeReleaseCnfParameters &)
+  {
+  }
+  virtual void CschedUeConfigUpdateInd (const struct CschedUeConfigUpdateIndParameters &)
+  {
+  }
+  virtual void CschedCellConfigUpdateInd (const struct CschedCellConfigUpdateIndParameters &)
+  {
+  }
+};
+
+int
+RunSchedulerBenchmark (uint32_t subframes, double interval)
+{
+  const uint32_t ueCounts[] = {100, 1000, 10000};
+  const char *types[2] = {"ns3::PfFfMacScheduler", "ns3::NbIotFfMacScheduler"};
+  const uint8_t bandwidth = 12;
+  uint32_t period = std::max (1.0, interval);    // [subframes]
+
+  std::cout << "Scheduler cost per subframe, " << subframes << " subframes, " << int (bandwidth)
+            << " RB, one 240 B BSR per UE every " << period << " ms" << std::endl;
+  for (uint32_t n = 0; n < 3; ++n)
+    {
+      // UE r reports in the subframes congruent to its offset: evenly spread
+      std::vector<std::vector<uint16_t> > reporting (period);
+      for (uint32_t rnti = 1; rnti <= ueCounts[n]; ++rnti)
+        {
+          reporting[uint64_t (rnti) * period / ueCounts[n] % period].push_back (rnti);
+        }
+
+      for (uint32_t m = 0; m < 2; ++m)
+        {
+          ObjectFactory factory (types[m]);
+          Ptr<FfMacScheduler> scheduler = factory.Create<FfMacScheduler> ();
+          Ptr<LteFrNoOpAlgorithm> ffr = CreateObject<LteFrNoOpAlgorithm> ();
+          ffr->SetUlBandwidth (bandwidth);
+          ffr->SetDlBandwidth (bandwidth);
+          scheduler->SetLteFfrSapProvider (ffr->GetLteFfrSapProvider ());
+          ffr->SetLteFfrSapUser (scheduler->GetLteFfrSapUser ());
+          BenchmarkCschedUser cschedUser;
+          BenchmarkSchedUser schedUser;
+          scheduler->SetFfMacCschedSapUser (&cschedUser);
+          scheduler->SetFfMacSchedSapUser (&schedUser);
+          FfMacCschedSapProvider *csched = scheduler->GetFfMacCschedSapProvider ();
+          FfMacSchedSapProvider *sched = scheduler->GetFfMacSchedSapProvider ();
+
+          FfMacCschedSapProvider::CschedCellConfigReqParameters cell;
+          cell.m_ulBandwidth = bandwidth;
+          cell.m_dlBandwidth = bandwidth;
+          csched->CschedCellConfigReq (cell);
+          LogicalChannelConfigListElement_s bearer;
+          bearer.m_logicalChannelIdentity = 3;
+          bearer.m_logicalChannelGroup = 0;
+          bearer.m_direction = LogicalChannelConfigListElement_s::DIR_BOTH;
+          bearer.m_qosBearerType = LogicalChannelConfigListElement_s::QBT_NON_GBR;
+          bearer.m_qci = 9;
+          bearer.m_eRabMaximulBitrateUl = 0;
+          bearer.m_eRabMaximulBitrateDl = 0;
+          bearer.m_eRabGuaranteedBitrateUl = 0;
+          bearer.m_eRabGuaranteedBitrateDl = 0;
+          for (uint32_t rnti = 1; rnti <= ueCounts[n]; ++rnti)
+            {
+              FfMacCschedSapProvider::CschedUeConfigReqParameters ue;
+              ue.m_rnti = rnti;
+              ue.m_transmissionMode = 0;
+              ue.m_reconfigureFlag = false;
+              csched->CschedUeConfigReq (ue);
+              FfMacCschedSapProvider::CschedLcConfigReqParameters lc;
+              lc.m_rnti = rnti;
+              lc.m_reconfigureFlag = false;
+              lc.m_logicalChannelConfigList.push_back (bearer);
+              csched->CschedLcConfigReq (lc);
+            }
+
+          MacCeListElement_s bsr;
+          bsr.m_macCeType = MacCeListElement_s::BSR;
+          bsr.m_macCeValue.m_bufferStatus.resize (4, 0);
+          bsr.m_macCeValue.m_bufferStatus[0] = BufferSizeLevelBsr::BufferSize2BsrId (240);
+          std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+          for (uint32_t k = 0; k < subframes; ++k)
+            {
+              uint16_t sfnSf = ((k / 10 % 1024 + 1) << 4) | (k % 10 + 1);
+              const std::vector<uint16_t> &reports = reporting[k % period];
+              if (!reports.empty ())
+                {
+                  FfMacSchedSapProvider::SchedUlMacCtrlInfoReqParameters ctrl;
+                  ctrl.m_sfnSf = sfnSf;
+                  for (uint32_t i = 0; i < reports.size (); ++i)
+                    {
+                      bsr.m_rnti = reports[i];
+                      ctrl.m_macCeList.push_back (bsr);
+                    }
+                  sched->SchedUlMacCtrlInfoReq (ctrl);
+                }
+              FfMacSchedSapProvider::SchedDlTriggerReqParameters dl;
+              dl.m_sfnSf = sfnSf;
+              sched->SchedDlTriggerReq (dl);
+              FfMacSchedSapProvider::SchedUlTriggerReqParameters ul;
+              ul.m_sfnSf = sfnSf;
+              sched->SchedUlTriggerReq (ul);
+            }
+          double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+          std::cout << std::setw (6) << ueCounts[n] << " UEs  " << std::setw (22) << std::left << types[m] << std::right
+                    << seconds / subframes * 1e6 << " us/subframe, " << schedUser.dcis << " DCIs" << std::endl;
+          scheduler->Dispose ();
+          ffr->Dispose ();
+        }
+    }
+  Simulator::Destroy ();
+  return 0;
+}
+
+DlReachabilityModel::DlReachabilityModel (std::string spec)
+  : m_dlPort (0)
+{
+  std::replace (spec.begin (), spec.end (), ',', ' ');
+  std::istringstream entries (spec);
+  std::string entry;
+  while (entries >> entry)
+    {
+      NS_ABORT_MSG_UNLESS (entry.size () > 2 && entry[1] == '=', "Malformed DL reachability entry: " << entry);
+      std::string values = entry.substr (2);
+      std::replace (values.begin (), values.end (), ':', ' ');
+      std::istringstream fields (values);
+      double inactivity, edrx, active, tau;
+      fields >> inactivity >> edrx >> active >> tau;
+      NS_ABORT_MSG_IF (fields.fail () || inactivity < 0 || edrx <= 0 || active < 0 || tau < 0,
+                       "DL reachability needs inactivity:edrx:active:tau [s], eDRX cycle > 0: " << entry);
+      Profile profile = {entry[0], Seconds (inactivity).GetNanoSeconds (), Seconds (edrx).GetNanoSeconds (),
+                         Seconds (active).GetNanoSeconds (), Seconds (tau).GetNanoSeconds ()};
+      m_profiles.push_back (profile);
+    }
+}
+
+bool
+DlReachabilityModel::Covers (char trafficClass) const
+{
+  for (uint32_t i = 0; i < m_profiles.size (); ++i)
+    {
+      if (m_profiles[i].trafficClass == trafficClass)
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+void
+DlReachabilityModel::Install (Ptr<Node> remoteHost, uint16_t dlPort)
+{
+  m_socket = Socket::CreateSocket (remoteHost, UdpSocketFactory::GetTypeId ());
+  m_socket->Bind ();
+  m_dlPort = dlPort;
+}
+
+void
+DlReachabilityModel::AddUe (uint64_t imsi, char trafficClass, Ipv4Address address, Time dlStart, Time dlInterval, uint32_t dlSize)
+{
+  uint32_t profile = 0;
+  while (m_profiles[profile].trafficClass != trafficClass)
+    {
+      ++profile;
+    }
+  int64_t now = Simulator::Now ().GetNanoSeconds ();
+  Ue ue;
+  ue.imsi = imsi;
+  ue.profile = profile;
+  ue.address = address;
+  ue.dlInterval = dlInterval.GetNanoSeconds ();
+  ue.dlSize = dlSize;
+  ue.nextDue = now + dlStart.GetNanoSeconds ();
+  ue.cycleStart = now;
+  ue.accounted = now;
+  ue.seq = 0;
+  std::fill (ue.seconds, ue.seconds + N_STATES, 0.0);
+  ue.taus = 0;
+  ue.wakes = 0;
+  ue.dlPackets = 0;
+  ue.holdSeconds = 0;
+  m_ues.push_back (ue);
+  if (imsi >= m_ueOfImsi.size ())
+    {
+      m_ueOfImsi.resize (imsi + 1, 0);
+    }
+  m_ueOfImsi[imsi] = m_ues.size ();
+  ScheduleDelivery (m_ues.size () - 1);
+}
+
+void
+DlReachabilityModel::Account (Ue &ue, int64_t now)
+{
+  const Profile &profile = m_profiles[ue.profile];
+  while (ue.accounted < now)
+    {
+      // State boundaries of the current cycle, which a TAU closes
+      int64_t released = ue.cycleStart + profile.inactivity;
+      int64_t cycleEnd = profile.tau > 0 ? released + profile.tau : std::numeric_limits<int64_t>::max ();
+      int64_t bounds[N_STATES] = {released, std::min (released + profile.active, cycleEnd), cycleEnd};
+      int64_t stop = std::min (now, cycleEnd);
+      for (uint32_t s = 0; s < N_STATES; ++s)
+        {
+          int64_t to = std::min (stop, bounds[s]);
+          if (to > ue.accounted)
+            {
+              ue.seconds[s] += (to - ue.accounted) * 1e-9;
+              ue.accounted = to;
+            }
+        }
+      if (stop == cycleEnd)
+        {
+          ++ue.taus;
+          ue.cycleStart = cycleEnd;
+        }
+    }
+}
+
+int64_t
+DlReachabilityModel::Reachable (const Ue &ue, int64_t t) const
+{
+  const Profile &profile = m_profiles[ue.profile];
+  int64_t cycle = ue.cycleStart;
+  if (profile.tau > 0)
+    {
+      int64_t period = profile.inactivity + profile.tau;
+      cycle += (t - cycle) / period * period;
+    }
+  int64_t released = cycle + profile.inactivity;
+  if (t < released)
+    {
+      return t;
+    }
+  int64_t edrxEnd = profile.tau > 0 ? released + std::min (profile.active, profile.tau) : released + profile.active;
+  int64_t pagingOccasion = released + (t - released + profile.edrx - 1) / profile.edrx * profile.edrx;
+  if (pagingOccasion < edrxEnd)
+    {
+      return pagingOccasion;
+    }
+  return profile.tau > 0 ? released + profile.tau : std::numeric_limits<int64_t>::max ();
+}
+
+void
+DlReachabilityModel::ScheduleDelivery (uint32_t index)
+{
+  Ue &ue = m_ues[index];
+  ue.delivery.Cancel ();
+  int64_t now = Simulator::Now ().GetNanoSeconds ();
+  int64_t at = Reachable (ue, std::max (now, ue.nextDue));
+  if (at < std::numeric_limits<int64_t>::max ())
+    {
+      ue.delivery = Simulator::Schedule (NanoSeconds (at - now), &DlReachabilityModel::Deliver, this, index);
+    }
+}
+
+void
+DlReachabilityModel::Deliver (uint32_t index)
+{
+  // A wake-up: the held DL data goes out and the timers restart
+  Ue &ue = m_ues[index];
+  int64_t now = Simulator::Now ().GetNanoSeconds ();
+  Account (ue, now);
+  ue.cycleStart = now;
+  ++ue.wakes;
+  while (ue.nextDue <= now)
+    {
+      Ptr<Packet> packet = Create<Packet> (ue.dlSize - std::min<uint32_t> (ue.dlSize, 12));
+      SeqTsHeader header;
+      header.SetSeq (ue.seq++);
+      packet->AddHeader (header);
+      if (m_socket->SendTo (packet, 0, InetSocketAddress (ue.address, m_dlPort)) >= 0)
+        {
+          ue.holdSeconds += (now - ue.nextDue) * 1e-9;
+          ++ue.dlPackets;
+        }
+      ue.nextDue += ue.dlInterval;
+    }
+  ScheduleDelivery (index);
+}
+
+void
+DlReachabilityModel::UplinkRx (uint64_t imsi, Ptr<const Packet>)
+{
+  if (imsi < m_ueOfImsi.size () && m_ueOfImsi[imsi] > 0)
+    {
+      Deliver (m_ueOfImsi[imsi] - 1);
+    }
+}
+
+void
+DlReachabilityModel::Report (std::string file)
+{
+  std::ofstream out (file.c_str ());
+  out << "imsi,class,reachableS,pagingS,unreachableS,taus,wakeUps,dlPackets,meanDlHoldMs" << std::endl;
+  std::vector<std::vector<double> > perProfile (m_profiles.size (), std::vector<double> (N_STATES, 0.0));
+  int64_t now = Simulator::Now ().GetNanoSeconds ();
+  for (uint32_t i = 0; i < m_ues.size (); ++i)
+    {
+      Ue &ue = m_ues[i];
+      Account (ue, now);
+      out << ue.imsi << "," << m_profiles[ue.profile].trafficClass << "," << ue.seconds[REACHABLE] << ","
+          << ue.seconds[PAGING] << "," << ue.seconds[UNREACHABLE] << "," << ue.taus << "," << ue.wakes << ","
+          << ue.dlPackets << "," << (ue.dlPackets > 0 ? ue.holdSeconds / ue.dlPackets * 1e3 : 0) << std::endl;
+      for (uint32_t s = 0; s < N_STATES; ++s)
+        {
+          perProfile[ue.profile][s] += ue.seconds[s];
+        }
+    }
+
+  for (uint32_t p = 0; p < m_profiles.size (); ++p)
+    {
+      double total = std::max (1e-9, perProfile[p][REACHABLE] + perProfile[p][PAGING] + perProfile[p][UNREACHABLE]);
+      std::cout << "DL reachability, class " << m_profiles[p].trafficClass << ": reachable "
+                << 100 * perProfile[p][REACHABLE] / total << "%, paging " << 100 * perProfile[p][PAGING] / total
+                << "%, unreachable " << 100 * perProfile[p][UNREACHABLE] / total << "%" << std::endl;
+    }
+}
+
+NodeContainer
+UesOfTier (NodeContainer ues, const CellGridIndex &macroIndex, const CellGridIndex &smallIndex,
+           double smallCellRange, bool small)
+{
+  std::vector<Vector> positions;
+  for (uint32_t u = 0; u < ues.GetN (); ++u)
+    {
+      positions.push_back (ues.Get (u)->GetObject<MobilityModel> ()->GetPosition ());
+    }
+  std::vector<UeAssociation> associations (positions.size ());
+  AssociateRange (&positions, &macroIndex, &smallIndex, smallCellRange, &associations, 0, positions.size ());
+  NodeContainer served;
+  for (uint32_t u = 0; u < ues.GetN (); ++u)
+    {
+      if (associations[u].useSmallCell == small)
+        {
+          served.Add (ues.Get (u));
+        }
+    }
+  return served;
+}
+
+void
+MergeTierKpis (std::string file, std::string tag, double wallSeconds)
+{
+  double ulPackets = 0;
+  double ulSent = 0;
+  double latencySum = 0;
+  double dlThroughput = 0;
+  double events = 0;
+  double eventsPerSecond = 0;
+  double simSecondsPerWallSecond = std::numeric_limits<double>::max ();
+  double peakRssMb = 0;
+  double outputBytes = 0;
+  for (uint32_t tier = 1; tier <= 2; ++tier)
+    {
+      std::ostringstream name;
+      name << file << tag << "_tier" << tier;
+      std::ifstream in (name.str ().c_str ());
+      NS_ABORT_MSG_UNLESS (in.is_open (), "Missing KPI file " << name.str ());
+      std::map<std::string, double> kpis;
+      std::string kpi;
+      double value;
+      while (in >> kpi >> value)
+        {
+          kpis[kpi] = value;
+        }
+      ulPackets += kpis["ulPackets"];
+      ulSent += kpis["ulLossRatio"] < 1 ? kpis["ulPackets"] / (1 - kpis["ulLossRatio"]) : 0;
+      latencySum += kpis["ulLatencyMs"] * kpis["ulPackets"];
+      dlThroughput += kpis["dlThroughputKbps"];
+      events += kpis["events"];
+      eventsPerSecond += kpis["eventsPerSecond"];    // the tiers run side by side
+      simSecondsPerWallSecond = std::min (simSecondsPerWallSecond, kpis["simSecondsPerWallSecond"]);
+      peakRssMb += kpis["peakRssMb"];
+      outputBytes += kpis["outputBytes"];
+    }
+
+  std::ofstream kpis (file.c_str ());
+  kpis << "ulPackets " << ulPackets << "\n"
+       << "ulLossRatio " << (ulSent > 0 ? 1 - ulPackets / ulSent : 0) << "\n"
+       << "ulLatencyMs " << (ulPackets > 0 ? latencySum / ulPackets : 0) << "\n"
+       << "dlThroughputKbps " << dlThroughput << "\n"
+       << "events " << events << "\n"
+       << "eventsPerSecond " << eventsPerSecond << "\n"
+       << "simSecondsPerWallSecond " << simSecondsPerWallSecond << "\n"
+       << "peakRssMb " << peakRssMb << "\n"
+       << "outputBytes " << outputBytes << "\n"
+       << "wallSeconds " << wallSeconds << "\n";
+}
+
+// Link budget of the culling threshold, from the attribute defaults in force
+// (Config::SetDefault, --ns3:: options, ConfigStore) when the devices are made
+struct CullingLinkBudget
+{
+  double dlRbs;
+  double ueNoiseFigure;     // [dB]
+  double enbNoiseFigure;    // [dB]
+  double ueTxPower;         // [dBm]
+};
+
+static double
+AttributeDefault (std::string type, std::string name)
+{
+  TypeId::AttributeInformation info;
+  NS_ABORT_MSG_UNLESS (TypeId::LookupByName (type).LookupAttributeByName (name, &info),
+                       "No attribute " << type << "::" << name);
+  return std::atof (info.initialValue->SerializeToString (info.checker).c_str ());
+}
+
+static CullingLinkBudget
+GetCullingLinkBudget ()
+{
+  CullingLinkBudget budget = {AttributeDefault ("ns3::LteEnbNetDevice", "DlBandwidth"),
+                              AttributeDefault ("ns3::LteUePhy", "NoiseFigure"),
+                              AttributeDefault ("ns3::LteEnbPhy", "NoiseFigure"),
+                              AttributeDefault ("ns3::LteUePhy", "TxPower")};
+  return budget;
+}
+
+// Thermal noise of one 180 kHz RB [dBm]
+static const double g_rbNoiseDbm = -174 + 10 * std::log10 (180e3);
+
+double
+CullingMaxLossDb (const std::vector<CellConfig> &cells, double marginDb)
+{
+  CullingLinkBudget budget = GetCullingLinkBudget ();
+  double maxLoss = budget.ueTxPower - (g_rbNoiseDbm + budget.enbNoiseFigure);
+  for (uint32_t i = 0; i < cells.size (); ++i)
+    {
+      double rbPower = cells[i].txPower - 10 * std::log10 (budget.dlRbs);
+      maxLoss = std::max (maxLoss, rbPower - (g_rbNoiseDbm + budget.ueNoiseFigure));
+    }
+  return maxLoss + marginDb;
+}
+
+void
+CullReceivers (CouplingLossTable &table, double maxLossDb, std::string file,
+               const std::vector<CellConfig> &cells, NodeContainer macroNodes, NodeContainer smallNodes,
+               const std::vector<NetDeviceContainer> &ueDevs,
+               const std::vector<std::vector<UeAssociation> > &associations)
+{
+  std::vector<uint32_t> layoutOf[2];
+  std::vector<Ptr<MobilityModel> > cellMobility;
+  for (uint32_t i = 0; i < cells.size (); ++i)
+    {
+      std::vector<uint32_t> &tier = layoutOf[cells[i].tier - 1];
+      cellMobility.push_back ((cells[i].tier == 1 ? macroNodes : smallNodes).Get (tier.size ())->GetObject<MobilityModel> ());
+      tier.push_back (i);
+    }
+
+  std::ofstream out (file.c_str ());
+  out << "link,id,cell,keptCells,culledCells,sinrDb,sinrErrorDb\n";
+  CullingLinkBudget budget = GetCullingLinkBudget ();
+  double ueNoise = std::pow (10, (g_rbNoiseDbm + budget.ueNoiseFigure) / 10);
+  double enbNoise = std::pow (10, (g_rbNoiseDbm + budget.enbNoiseFigure) / 10);
+  std::vector<double> strongestCulled (cells.size () * cells.size (), 0);  // [victim * cells + serving] [mW]
+  uint64_t pairs = 0;
+  uint64_t culled[2] = {0, 0};          // DL, UL
+  uint64_t crossCarrier[2] = {0, 0};
+  uint32_t ues = 0;
+  double dlErrorSum = 0;
+  double dlErrorMax = 0;
+  for (uint32_t c = 0; c < ueDevs.size (); ++c)
+    {
+      for (uint32_t u = 0; u < ueDevs[c].GetN (); ++u)
+        {
+          const UeAssociation &a = associations[c][u];
+          uint32_t serving = a.useSmallCell ? layoutOf[1][a.smallCell] : layoutOf[0][a.macroCell];
+          uint32_t dlCarrier = cells[serving].dlEarfcn;
+          uint32_t ulCarrier = cells[serving].ulEarfcn;
+          Ptr<NetDevice> dev = ueDevs[c].Get (u);
+          Ptr<MobilityModel> ue = dev->GetNode ()->GetObject<MobilityModel> ();
+          table.SetUeCarrier (ue, dlCarrier, ulCarrier);
+
+          double signal = 0;
+          double kept = 0;
+          double dropped = 0;
+          uint32_t keptCells = 0;
+          uint32_t culledCells = 0;
+          for (uint32_t i = 0; i < cells.size (); ++i)
+            {
+              // UL: this UE into cell i, on the RB its serving cell gives it
+              if (cells[i].ulEarfcn != ulCarrier)
+                {
+                  ++crossCarrier[1];
+                }
+              else if (i != serving)
+                {
+                  double loss = table.GetLossDb (ue, cellMobility[i]);
+                  if (loss > maxLossDb)
+                    {
+                      ++culled[1];
+                      double &strongest = strongestCulled[size_t (i) * cells.size () + serving];
+                      strongest = std::max (strongest, std::pow (10, (budget.ueTxPower - loss) / 10));
+                    }
+                }
+
+              // DL: cell i into this UE
+              if (cells[i].dlEarfcn != dlCarrier)
+                {
+                  ++crossCarrier[0];
+                  continue;
+                }
+              double loss = table.GetLossDb (cellMobility[i], ue);
+              double rx = std::pow (10, (cells[i].txPower - 10 * std::log10 (budget.dlRbs) - loss) / 10);
+              if (i == serving)
+                {
+                  signal = rx;
+                }
+              else if (loss > maxLossDb)
+                {
+                  dropped += rx;
+                  ++culledCells;
+                }
+              else
+                {
+                  kept += rx;
+                  ++keptCells;
+                }
+            }
+          double error = 10 * std::log10 ((ueNoise + kept + dropped) / (ueNoise + kept));
+          out << "dl," << dev->GetObject<LteUeNetDevice> ()->GetImsi () << "," << serving << "," << keptCells
+              << "," << culledCells << "," << 10 * std::log10 (signal / (ueNoise + kept + dropped)) << ","
+              << error << "\n";
+          pairs += cells.size ();
+          culled[0] += culledCells;
+          dlErrorSum += error;
+          dlErrorMax = std::max (dlErrorMax, error);
+          ++ues;
+        }
+    }
+
+  double ulErrorMax = 0;
+  for (uint32_t i = 0; i < cells.size (); ++i)
+    {
+      double dropped = 0;
+      uint32_t culledCells = 0;
+      for (uint32_t j = 0; j < cells.size (); ++j)
+        {
+          double strongest = strongestCulled[size_t (i) * cells.size () + j];
+          if (strongest > 0)
+            {
+              dropped += strongest;
+              ++culledCells;
+            }
+        }
+      double bound = 10 * std::log10 (1 + dropped / enbNoise);
+      out << "ul," << i << "," << i << ",," << culledCells << ",," << bound << "\n";
+      ulErrorMax = std::max (ulErrorMax, bound);
+    }
+
+  std::cout << "Receiver culling beyond " << maxLossDb << " dB, UE-cell links dropped: DL "
+            << (pairs > 0 ? 100.0 * (culled[0] + crossCarrier[0]) / pairs : 0) << "% ("
+            << (pairs > 0 ? 100.0 * crossCarrier[0] / pairs : 0) << "% other carrier, exact), UL "
+            << (pairs > 0 ? 100.0 * (culled[1] + crossCarrier[1]) / pairs : 0) << "% ("
+            << (pairs > 0 ? 100.0 * crossCarrier[1] / pairs : 0) << "% other carrier, exact); DL SINR error mean "
+            << (ues > 0 ? dlErrorSum / ues : 0) << " dB max " << dlErrorMax << " dB, UL bound max "
+            << ulErrorMax << " dB (" << file << ")" << std::endl;
+}
+
+int
+RunAmcBenchmark (uint32_t ues, uint32_t reports)
+{
+  const uint16_t rbs = 12;
+  Ptr<LteAmc> amc = CreateObject<LteAmc> ();
+  amc->SetAttribute ("AmcModel", EnumValue (LteAmc::PiroEW2010));
+  BatchAmc batch (amc, rbs);
+
+  // SINR from -10 to 30 dB, a few RBs without signal, and the doubles on
+  // both sides of every CQI step
+  Ptr<UniformRandomVariable> rv = CreateObject<UniformRandomVariable> ();
+  std::vector<double> sinr (size_t (rbs) * ues);
+  for (size_t i = 0; i < sinr.size (); ++i)
+    {
+      sinr[i] = rv->GetValue () < 0.02 ? 0 : std::pow (10, rv->GetValue (-10, 30) / 10);
+    }
+  for (uint32_t cqi = 1; cqi < 16 && 2 * cqi < sinr.size (); ++cqi)
+    {
+      double step = batch.GetCqiThreshold (cqi);
+      sinr[2 * cqi - 2] = step;
+      sinr[2 * cqi - 1] = std::nextafter (step, 0.0);
+    }
+
+  // Scalar path: one SpectrumValue per UE report, as the UE PHY hands it over
+  Ptr<SpectrumModel> model = LteSpectrumValueHelper::GetSpectrumModel (100, rbs);
+  std::vector<SpectrumValue> spectra;
+  for (uint32_t u = 0; u < ues; ++u)
+    {
+      SpectrumValue value (model);
+      for (uint16_t rb = 0; rb < rbs; ++rb)
+        {
+          value[rb] = sinr[size_t (rb) * ues + u];
+        }
+      spectra.push_back (value);
+    }
+
+  std::vector<int8_t> scalarCqi (sinr.size ());
+  std::vector<uint8_t> scalarMcs (ues);
+  std::vector<uint32_t> scalarTbs (ues);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+  for (uint32_t r = 0; r < reports; ++r)
+    {
+      for (uint32_t u = 0; u < ues; ++u)
+        {
+          std::vector<int> cqi = amc->CreateCqiFeedbacks (spectra[u]);
+          double cqiSum = 0;
+          int active = 0;
+          for (uint16_t rb = 0; rb < rbs; ++rb)
+            {
+              scalarCqi[size_t (rb) * ues + u] = cqi[rb];
+              if (cqi[rb] != -1)
+                {
+                  cqiSum += cqi[rb];
+                  ++active;
+                }
+            }
+          int wbCqi = active > 0 ? (uint16_t) cqiSum / active : 1;
+          scalarMcs[u] = amc->GetMcsFromCqi (wbCqi);
+          scalarTbs[u] = amc->GetDlTbSizeFromMcs (scalarMcs[u], rbs);
+        }
+    }
+  double scalarSeconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+  std::vector<int8_t> cqi (sinr.size ());
+  std::vector<uint8_t> wbCqi (ues);
+  std::vector<uint8_t> mcs (ues);
+  std::vector<uint32_t> tbs (ues);
+  start = std::chrono::steady_clock::now ();
+  for (uint32_t r = 0; r < reports; ++r)
+    {
+      batch.Evaluate (ues, rbs, sinr.data (), cqi.data (), wbCqi.data (), mcs.data (), tbs.data ());
+    }
+  double batchSeconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+  uint32_t mismatches = 0;
+  for (size_t i = 0; i < cqi.size (); ++i)
+    {
+      mismatches += cqi[i] != scalarCqi[i];
+    }
+  for (uint32_t u = 0; u < ues; ++u)
+    {
+      mismatches += mcs[u] != scalarMcs[u] || tbs[u] != scalarTbs[u];
+    }
+
+  double calls = double (reports) * ues;
+  std::cout << "PiroEW2010 AMC, " << ues << " UEs x " << rbs << " RB, " << reports << " reports each" << std::endl;
+  std::cout << "scalar:  " << scalarSeconds / calls * 1e9 << " ns/report" << std::endl;
+  std::cout << "batched: " << batchSeconds / calls * 1e9 << " ns/report (" << scalarSeconds / batchSeconds
+            << "x)" << std::endl;
+  std::cout << "mismatches: " << mismatches << std::endl;
+  Simulator::Destroy ();
+  return mismatches > 0 ? 1 : 0;
+}
+
+PayloadSize
+PayloadSize::Parse (std::string spec)
+{
+  std::string fields = spec;
+  std::replace (fields.begin (), fields.end (), ':', ' ');
+  std::istringstream in (fields);
+  PayloadSize size = {CONSTANT, 0, 0};
+  std::string kind;
+  in >> kind;
+  if (kind == "uniform")
+    {
+      size.kind = UNIFORM;
+      in >> size.a >> size.b;
+      NS_ABORT_MSG_IF (in.fail () || size.b < size.a, "uniform payload needs min:max: " << spec);
+    }
+  else if (kind == "exp")
+    {
+      size.kind = EXPONENTIAL;
+      in >> size.a;
+      NS_ABORT_MSG_IF (in.fail () || size.a <= 0, "exp payload needs a positive mean: " << spec);
+    }
+  else if (kind == "normal")
+    {
+      size.kind = NORMAL;
+      in >> size.a >> size.b;
+      NS_ABORT_MSG_IF (in.fail () || size.b < 0, "normal payload needs mean:sd: " << spec);
+    }
+  else
+    {
+      std::istringstream constant (kind);
+      constant >> size.a;
+      NS_ABORT_MSG_IF (constant.fail () || size.a < 0, "Unknown payload size: " << spec);
+    }
+  return size;
+}
+
+double
+PayloadSize::GetMean () const
+{
+  return kind == UNIFORM ? (a + b) / 2 : a;
+}
+
+std::vector<TrafficClass>
+LoadTrafficMix (std::string fileName)
+{
+  std::ifstream in (fileName.c_str ());
+  NS_ABORT_MSG_UNLESS (in.is_open (), "Cannot open traffic mix file " << fileName);
+  std::vector<TrafficClass> mix;
+  std::string line;
+  uint32_t lineNo = 0;
+  while (std::getline (in, line))
+    {
+      ++lineNo;
+      std::replace (line.begin (), line.end (), ',', ' ');
+      std::istringstream fields (line);
+      std::string label, arrival, direction, ulSize, dlSize;
+      if (!(fields >> label) || label[0] == '#' || label == "label")
+        {
+          continue; // blank line, comment or header
+        }
+      TrafficClass c;
+      fields >> c.share >> arrival >> c.period >> c.jitter >> c.start >> direction >> ulSize >> dlSize;
+      NS_ABORT_MSG_IF (fields.fail (), fileName << ":" << lineNo << ": expected 9 fields");
+      NS_ABORT_MSG_IF (label.size () != 1, fileName << ":" << lineNo << ": the label is one character");
+      NS_ABORT_MSG_IF (c.share < 0 || c.period <= 0 || c.jitter < 0,
+                       fileName << ":" << lineNo << ": share and jitter must be >= 0, period > 0");
+      NS_ABORT_MSG_UNLESS (arrival == "periodic" || arrival == "poisson",
+                           fileName << ":" << lineNo << ": arrival must be periodic or poisson");
+      NS_ABORT_MSG_UNLESS (direction == "ul" || direction == "dl" || direction == "both",
+                           fileName << ":" << lineNo << ": direction must be ul, dl or both");
+      c.label = label[0];
+      c.poisson = arrival == "poisson";
+      c.ul = direction != "dl";
+      c.dl = direction != "ul";
+      c.ulSize = PayloadSize::Parse (c.ul ? ulSize : "0");
+      c.dlSize = PayloadSize::Parse (c.dl ? dlSize : "0");
+      for (uint32_t i = 0; i < mix.size (); ++i)
+        {
+          NS_ABORT_MSG_IF (mix[i].label == c.label, fileName << ":" << lineNo << ": class " << c.label << " defined twice");
+        }
+      mix.push_back (c);
+    }
+  return mix;
+}
+
+std::vector<TrafficClass>
+DefaultTrafficMix (const double intervals[3], const std::string starts[3], uint32_t ulSize)
+{
+  const char labels[] = {'A', 'B', 'C'};
+  const double shares[] = {0.1, 0.8, 0.1};
+  const double dlSizes[] = {double (ulSize), 200, 200};
+  std::vector<TrafficClass> mix;
+  for (uint32_t c = 0; c < 3; ++c)
+    {
+      PayloadSize ul = {PayloadSize::CONSTANT, double (ulSize), 0};
+      PayloadSize dl = {PayloadSize::CONSTANT, dlSizes[c], 0};
+      TrafficClass traffic = {labels[c], shares[c], false, intervals[c] / 1000, 0, starts[c], true, true, ul, dl};
+      mix.push_back (traffic);
+    }
+  return mix;
+}
+
+// Slot of the traffic wheels: one subframe
+static const int64_t g_trafficSlotNs = 1000000;
+
+TrafficWheel::TrafficWheel (const TrafficClass &traffic, Ptr<Node> remoteHost, Address ulDestination, uint16_t dlPort)
+  : m_traffic (traffic),
+    m_ulDestination (ulDestination),
+    m_dlPort (dlPort),
+    m_now (0),
+    m_armed (0)
+{
+  m_uniform = CreateObject<UniformRandomVariable> ();
+  m_exponential = CreateObject<ExponentialRandomVariable> ();
+  m_normal = CreateObject<NormalRandomVariable> ();
+  if (traffic.dl)
+    {
+      m_dlSocket = Socket::CreateSocket (remoteHost, UdpSocketFactory::GetTypeId ());
+      m_dlSocket->Bind ();
+    }
+
+  // A power of two covering one period, so periodic flows come round once
+  // per revolution; longer (Poisson) gaps wait for later rounds in their slot
+  uint64_t span = (traffic.period + traffic.jitter) * 1e9 / g_trafficSlotNs + 2;
+  uint64_t slots = 1024;
+  while (slots < span && slots < 65536)
+    {
+      slots *= 2;
+    }
+  m_slots.resize (slots);
+}
+
+void
+TrafficWheel::AddUplink (Ptr<Node> ue, Time start, uint32_t sizeScale)
+{
+  Flow flow;
+  flow.socket = Socket::CreateSocket (ue, UdpSocketFactory::GetTypeId ());
+  flow.socket->Bind ();
+  flow.socket->Connect (m_ulDestination);
+  flow.sizeScale = sizeScale;
+  Add (flow, start);
+}
+
+void
+TrafficWheel::AddDownlink (Ipv4Address ue, Time start)
+{
+  NS_ABORT_MSG_UNLESS (m_dlSocket, "Traffic class " << m_traffic.label << " has no downlink");
+  Flow flow;
+  flow.address = ue;
+  flow.sizeScale = 1;
+  Add (flow, start);
+}
+
+uint32_t
+TrafficWheel::GetFlows () const
+{
+  return m_flows.size ();
+}
+
+void
+TrafficWheel::Add (const Flow &added, Time start)
+{
+  m_flows.push_back (added);
+  Flow &flow = m_flows.back ();
+  flow.seq = 0;
+  flow.nominal = (Simulator::Now () + start).GetNanoSeconds ();
+  flow.due = (flow.nominal + g_trafficSlotNs - 1) / g_trafficSlotNs;
+  Insert (m_flows.size () - 1);
+  if (!m_event.IsRunning () || flow.due < m_armed)
+    {
+      m_event.Cancel ();
+      m_armed = flow.due;
+      m_event = Simulator::Schedule (NanoSeconds (m_armed * g_trafficSlotNs) - Simulator::Now (), &TrafficWheel::Fire, this);
+    }
+}
+
+void
+TrafficWheel::Insert (uint32_t flow)
+{
+  m_slots[m_flows[flow].due & (m_slots.size () - 1)].push_back (flow);
+}
+
+void
+TrafficWheel::Arm ()
+{
+  // The next slot with a flow due in this round, else the earliest due flow
+  uint64_t mask = m_slots.size () - 1;
+  uint64_t next = std::numeric_limits<uint64_t>::max ();
+  for (uint64_t t = m_now + 1; t <= m_now + m_slots.size () && next == std::numeric_limits<uint64_t>::max (); ++t)
+    {
+      const std::vector<uint32_t> &slot = m_slots[t & mask];
+      for (uint32_t i = 0; i < slot.size (); ++i)
+        {
+          if (m_flows[slot[i]].due == t)
+            {
+              next = t;
+              break;
+            }
+        }
+    }
+  if (next == std::numeric_limits<uint64_t>::max ())
+    {
+      for (uint32_t f = 0; f < m_flows.size (); ++f)
+        {
+          next = std::min (next, m_flows[f].due);
+        }
+      if (next == std::numeric_limits<uint64_t>::max ())
+        {
+          return;
+        }
+    }
+  m_armed = next;
+  m_event = Simulator::Schedule (NanoSeconds (m_armed * g_trafficSlotNs) - Simulator::Now (), &TrafficWheel::Fire, this);
+}
+
+void
+TrafficWheel::Fire ()
+{
+  m_now = m_armed;
+  int64_t periodNs = Seconds (m_traffic.period).GetNanoSeconds ();
+  std::vector<uint32_t> slot;
+  slot.swap (m_slots[m_now & (m_slots.size () - 1)]);
+  for (uint32_t i = 0; i < slot.size (); ++i)
+    {
+      Flow &flow = m_flows[slot[i]];
+      if (flow.due != m_now)
+        {
+          Insert (slot[i]);    // a later round
+          continue;
+        }
+      Send (flow);
+      flow.nominal += m_traffic.poisson ? Seconds (m_exponential->GetValue (m_traffic.period, 0)).GetNanoSeconds () : periodNs;
+      int64_t at = flow.nominal;
+      if (!m_traffic.poisson && m_traffic.jitter > 0)
+        {
+          at += Seconds (m_uniform->GetValue (0, m_traffic.jitter)).GetNanoSeconds ();
+        }
+      flow.due = std::max<uint64_t> ((at + g_trafficSlotNs - 1) / g_trafficSlotNs, m_now + 1);
+      Insert (slot[i]);
+    }
+  Arm ();
+}
+
+void
+TrafficWheel::Send (Flow &flow)
+{
+  const PayloadSize &size = flow.socket ? m_traffic.ulSize : m_traffic.dlSize;
+  double bytes = size.a;
+  switch (size.kind)
+    {
+    case PayloadSize::UNIFORM:
+      bytes = m_uniform->GetValue (size.a, size.b);
+      break;
+    case PayloadSize::EXPONENTIAL:
+      bytes = m_exponential->GetValue (size.a, 0);
+      break;
+    case PayloadSize::NORMAL:
+      bytes = m_normal->GetValue (size.a, size.b * size.b);
+      break;
+    default:
+      break;
+    }
+  uint32_t total = std::max (12.0, std::floor (bytes + 0.5)) * flow.sizeScale;
+  Ptr<Packet> packet = Create<Packet> (total - 12);
+  SeqTsHeader header;
+  header.SetSeq (flow.seq++);
+  packet->AddHeader (header);
+  if (flow.socket)
+    {
+      flow.socket->Send (packet);
+    }
+  else
+    {
+      m_dlSocket->SendTo (packet, 0, InetSocketAddress (flow.address, m_dlPort));
+    }
+}
+
+std::vector<CellConfig>
+DensifiedTopology (uint32_t cells)
+{
+  std::vector<CellConfig> layout = DefaultTopology ();
+  CellConfig small = layout.back ();
+  std::mt19937 rng (1);
+  std::uniform_real_distribution<double> x (-1200, 800);
+  std::uniform_real_distribution<double> y (-900, 800);
+  while (layout.size () < cells)
+    {
+      ++small.site;
+      small.x = x (rng);
+      small.y = y (rng);
+      layout.push_back (small);
+    }
+  return layout;
+}
+
+uint64_t
+OutputBytes (std::string tag, time_t since)
+{
+  uint64_t bytes = 0;
+  DIR *dir = opendir (".");
+  if (!dir)
+    {
+      return 0;
+    }
+  while (struct dirent *entry = readdir (dir))
+    {
+      struct stat info;
+      // The tag, not a longer one it is a prefix of (_run1 in _run12)
+      const char *match = std::strstr (entry->d_name, tag.c_str ());
+      if (match && !std::isdigit (static_cast<unsigned char> (match[tag.size ()]))
+          && stat (entry->d_name, &info) == 0 && S_ISREG (info.st_mode) && info.st_mtime >= since)
+        {
+          bytes += info.st_size;
+        }
+    }
+  closedir (dir);
+  return bytes;
+}
+
+int
+RunScalingBenchmark (const char *program, const std::vector<std::string> &baseArgs, std::string matrix,
+                     std::string baseline, double tolerance, std::string output)
+{
+  // cells=n,... becomes one densified layout file per count
+  std::replace (matrix.begin (), matrix.end (), ';', ' ');
+  std::istringstream parameters (matrix);
+  std::string parameter;
+  std::string grid;
+  while (parameters >> parameter)
+    {
+      if (parameter.compare (0, 6, "cells=") == 0)
+        {
+          std::string counts = parameter.substr (6);
+          std::replace (counts.begin (), counts.end (), ',', ' ');
+          std::istringstream items (counts);
+          uint32_t cells;
+          parameter = "topology=";
+          while (items >> cells)
+            {
+              std::ostringstream file;
+              file << "ScalingLayout" << cells << ".bin";
+              SaveTopology (file.str (), DensifiedTopology (cells));
+              parameter += (parameter.size () > 9 ? "," : "") + file.str ();
+            }
+        }
+      grid += (grid.empty () ? "" : ";") + parameter;
+    }
+
+  int failed = RunSweep (program, baseArgs, grid, 1, 1, 0, 0, output);
+
+  // Both files are sweep outputs: parameter columns, runs, then KPI,KPICi95 pairs
+  static const char *lowerIsBetter[] = {"wallSeconds", "peakRssMb", "outputBytes"};
+  static const char *higherIsBetter[] = {"simSecondsPerWallSecond", "eventsPerSecond"};
+  std::map<std::string, std::map<std::string, double> > results[2];
+  std::string files[2] = {output, baseline};
+  for (uint32_t f = 0; f < 2; ++f)
+    {
+      std::ifstream in (files[f].c_str ());
+      std::string line;
+      std::vector<std::string> header;
+      while (std::getline (in, line))
+        {
+          std::replace (line.begin (), line.end (), ',', ' ');
+          std::istringstream fields (line);
+          std::vector<std::string> row ((std::istream_iterator<std::string> (fields)), std::istream_iterator<std::string> ());
+          if (header.empty ())
+            {
+              header = row;
+              continue;
+            }
+          uint32_t runs = std::find (header.begin (), header.end (), "runs") - header.begin ();
+          std::string point;
+          for (uint32_t i = 0; i < runs && i < row.size (); ++i)
+            {
+              point += (point.empty () ? "" : " ") + header[i] + "=" + row[i];
+            }
+          for (uint32_t i = runs + 1; i < row.size () && i < header.size (); ++i)
+            {
+              results[f][point][header[i]] = std::atof (row[i].c_str ());
+            }
+        }
+      if (f == 1 && header.empty ())
+        {
+          // A baseline with missing points would hide their regressions later
+          if (failed > 0)
+            {
+              std::cout << "Scaling: no baseline yet, not saved: " << failed << " failed runs" << std::endl;
+              return failed;
+            }
+          std::ifstream from (output.c_str (), std::ios::binary);
+          std::ofstream to (baseline.c_str (), std::ios::binary);
+          to << from.rdbuf ();
+          std::cout << "Scaling: no baseline yet, " << output << " saved as " << baseline << std::endl;
+          return failed;
+        }
+    }
+
+  int regressions = 0;
+  std::map<std::string, std::map<std::string, double> >::const_iterator point;
+  for (point = results[0].begin (); point != results[0].end (); ++point)
+    {
+      std::map<std::string, std::map<std::string, double> >::const_iterator reference = results[1].find (point->first);
+      if (reference == results[1].end ())
+        {
+          std::cout << point->first << ": not in the baseline" << std::endl;
+          continue;
+        }
+      for (uint32_t k = 0; k < 5; ++k)
+        {
+          bool lower = k < 3;
+          std::string kpi = lower ? lowerIsBetter[k] : higherIsBetter[k - 3];
+          std::map<std::string, double>::const_iterator now = point->second.find (kpi);
+          std::map<std::string, double>::const_iterator then = reference->second.find (kpi);
+          if (now == point->second.end () || then == reference->second.end () || then->second <= 0)
+            {
+              continue;
+            }
+          double change = now->second / then->second - 1;
+          bool worse = lower ? change > tolerance : change < -tolerance;
+          regressions += worse;
+          std::cout << point->first << " " << kpi << " " << then->second << " -> " << now->second << " ("
+                    << std::showpos << 100 * change << std::noshowpos << "%)" << (worse ? " REGRESSION" : "")
+                    << std::endl;
+        }
+    }
+  std::cout << "Scaling: " << regressions << " KPIs beyond " << 100 * tolerance << "% of " << baseline << std::endl;
+  return failed + regressions;
+}
@@ -0,0 +1,493 @@
+#include "nbiot-ff-mac-scheduler.h"
+#include "ns3/rr-ff-mac-scheduler.h"
+#include "ns3/lte-common.h"
+#include "ns3/string.h"
+#include "ns3/abort.h"
+#include <algorithm>
+#include <sstream>
+
+namespace ns3 {
+
+// 36.213 Table 16.5.1.2-2: NPUSCH transport block size [bit] by I_TBS and I_RU
+static const uint16_t g_npuschTbs[13][8] = {
+  {16, 32, 56, 88, 120, 152, 208, 256},
+  {24, 56, 88, 144, 176, 208, 256, 344},
+  {32, 72, 144, 176, 208, 256, 328, 424},
+  {40, 104, 176, 208, 256, 328, 440, 568},
+  {56, 120, 208, 256, 328, 408, 552, 680},
+  {72, 144, 224, 328, 424, 504, 680, 872},
+  {88, 176, 256, 392, 504, 600, 808, 1032},
+  {104, 224, 328, 472, 584, 680, 968, 1224},
+  {120, 256, 392, 536, 680, 808, 1096, 1352},
+  {136, 296, 456, 616, 776, 936, 1256, 1544},
+  {144, 328, 504, 680, 872, 1032, 1384, 1736},
+  {176, 376, 584, 776, 1000, 1192, 1608, 2024},
+  {208, 440, 680, 904, 1128, 1352, 1800, 2280}
+};
+// Number of RUs by I_RU
+static const uint32_t g_npuschRus[8] = {1, 2, 3, 4, 5, 6, 8, 10};
+// As the ns-3 schedulers' UL HARQ
+static const uint8_t g_maxUlRetx = 3;
+
+class NbIotFfMacScheduler::CschedProvider : public FfMacCschedSapProvider
+{
+public:
+  CschedProvider (NbIotFfMacScheduler *scheduler)
+    : m_scheduler (scheduler)
+  {
+  }
+  virtual void CschedCellConfigReq (const struct CschedCellConfigReqParameters &params)
+  {
+    m_scheduler->CellConfig (params.m_ulBandwidth);
+    m_scheduler->m_innerCsched->CschedCellConfigReq (params);
+  }
+  virtual void CschedUeConfigReq (const struct CschedUeConfigReqParameters &params)
+  {
+    m_scheduler->UeConfig (params.m_rnti);
+    m_scheduler->m_innerCsched->CschedUeConfigReq (params);
+  }
+  virtual void CschedLcConfigReq (const struct CschedLcConfigReqParameters &params)
+  {
+    m_scheduler->m_innerCsched->CschedLcConfigReq (params);
+  }
+  virtual void CschedLcReleaseReq (const struct CschedLcReleaseReqParameters &params)
+  {
+    m_scheduler->m_innerCsched->CschedLcReleaseReq (params);
+  }
+  virtual void CschedUeReleaseReq (const struct CschedUeReleaseReqParameters &params)
+  {
+    m_scheduler->UeRelease (params.m_rnti);
+    m_scheduler->m_innerCsched->CschedUeReleaseReq (params);
+  }
+
+private:
+  NbIotFfMacScheduler *m_scheduler;
+};
+
+// Downlink requests go to the inner scheduler; the uplink ones are handled
+// here. UL CQI, SR and interference reports are not used: the MCS follows the
+// CE level and the UE MAC reports its buffer with BSRs.
+class NbIotFfMacScheduler::SchedProvider : public FfMacSchedSapProvider
+{
+public:
+  SchedProvider (NbIotFfMacScheduler *scheduler)
+    : m_scheduler (scheduler)
+  {
+  }
+  virtual void SchedDlRlcBufferReq (const struct SchedDlRlcBufferReqParameters &params)
+  {
+    m_scheduler->m_innerSched->SchedDlRlcBufferReq (params);
+  }
+  virtual void SchedDlPagingBufferReq (const struct SchedDlPagingBufferReqParameters &params)
+  {
+    m_scheduler->m_innerSched->SchedDlPagingBufferReq (params);
+  }
+  virtual void SchedDlMacBufferReq (const struct SchedDlMacBufferReqParameters &params)
+  {
+    m_scheduler->m_innerSched->SchedDlMacBufferReq (params);
+  }
+  virtual void SchedDlTriggerReq (const struct SchedDlTriggerReqParameters &params)
+  {
+    m_scheduler->m_innerSched->SchedDlTriggerReq (params);
+  }
+  virtual void SchedDlRachInfoReq (const struct SchedDlRachInfoReqParameters &params)
+  {
+    m_scheduler->m_innerSched->SchedDlRachInfoReq (params);
+  }
+  virtual void SchedDlCqiInfoReq (const struct SchedDlCqiInfoReqParameters &params)
+  {
+    m_scheduler->m_innerSched->SchedDlCqiInfoReq (params);
+  }
+  virtual void SchedUlTriggerReq (const struct SchedUlTriggerReqParameters &params)
+  {
+    m_scheduler->UlTrigger (params);
+  }
+  virtual void SchedUlNoiseInterferenceReq (const struct SchedUlNoiseInterferenceReqParameters &)
+  {
+  }
+  virtual void SchedUlSrInfoReq (const struct SchedUlSrInfoReqParameters &)
+  {
+  }
+  virtual void SchedUlMacCtrlInfoReq (const struct SchedUlMacCtrlInfoReqParameters &params)
+  {
+    m_scheduler->MacCtrlInfo (params);
+  }
+  virtual void SchedUlCqiInfoReq (const struct SchedUlCqiInfoReqParameters &)
+  {
+  }
+
+private:
+  NbIotFfMacScheduler *m_scheduler;
+};
+
+// Sits between the inner scheduler and the MAC to see the Msg3 grants of the
+// random access responses
+class NbIotFfMacScheduler::SchedUser : public FfMacSchedSapUser
+{
+public:
+  SchedUser (NbIotFfMacScheduler *scheduler)
+    : m_scheduler (scheduler)
+  {
+  }
+  virtual void SchedDlConfigInd (const struct SchedDlConfigIndParameters &params)
+  {
+    m_scheduler->ReserveRar (params);
+    m_scheduler->m_user->SchedDlConfigInd (params);
+  }
+  virtual void SchedUlConfigInd (const struct SchedUlConfigIndParameters &params)
+  {
+    m_scheduler->m_user->SchedUlConfigInd (params);
+  }
+
+private:
+  NbIotFfMacScheduler *m_scheduler;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (NbIotFfMacScheduler);
+
+TypeId
+NbIotFfMacScheduler::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::NbIotFfMacScheduler")
+    .SetParent<FfMacScheduler> ()
+    .AddConstructor<NbIotFfMacScheduler> ()
+    .AddAttribute ("Tones", "NPUSCH subcarriers per RU of CE levels 0, 1 and 2 (12, 6, 3 or 1)",
+                   StringValue ("12:3:1"),
+                   MakeStringAccessor (&NbIotFfMacScheduler::m_tones),
+                   MakeStringChecker ())
+    .AddAttribute ("Repetitions", "Repetition factor of CE levels 0, 1 and 2",
+                   StringValue ("1:8:32"),
+                   MakeStringAccessor (&NbIotFfMacScheduler::m_repetitions),
+                   MakeStringChecker ())
+    .AddAttribute ("Itbs", "NPUSCH TBS index of CE levels 0, 1 and 2 (0-12)",
+                   StringValue ("10:4:0"),
+                   MakeStringAccessor (&NbIotFfMacScheduler::m_itbs),
+                   MakeStringChecker ())
+    .AddAttribute ("Mcs", "LTE MCS of the 1-RB TTI that carries the transport block, per CE level",
+                   StringValue ("8:2:0"),
+                   MakeStringAccessor (&NbIotFfMacScheduler::m_mcs),
+                   MakeStringChecker ())
+  ;
+  return tid;
+}
+
+NbIotFfMacScheduler::NbIotFfMacScheduler ()
+  : m_user (0),
+    m_tones ("12:3:1"),
+    m_repetitions ("1:8:32"),
+    m_itbs ("10:4:0"),
+    m_mcs ("8:2:0"),
+    m_ulBandwidth (0)
+{
+  m_inner = CreateObject<RrFfMacScheduler> ();
+  m_innerCsched = m_inner->GetFfMacCschedSapProvider ();
+  m_innerSched = m_inner->GetFfMacSchedSapProvider ();
+  m_cschedProvider = new CschedProvider (this);
+  m_schedProvider = new SchedProvider (this);
+  m_schedUser = new SchedUser (this);
+  m_inner->SetFfMacSchedSapUser (m_schedUser);
+  CellConfig (0);
+}
+
+NbIotFfMacScheduler::~NbIotFfMacScheduler ()
+{
+}
+
+void
+NbIotFfMacScheduler::DoDispose (void)
+{
+  m_inner->Dispose ();
+  m_inner = 0;
+  delete m_cschedProvider;
+  delete m_schedProvider;
+  delete m_schedUser;
+  FfMacScheduler::DoDispose ();
+}
+
+void
+NbIotFfMacScheduler::SetFfMacCschedSapUser (FfMacCschedSapUser *s)
+{
+  m_inner->SetFfMacCschedSapUser (s);
+}
+
+void
+NbIotFfMacScheduler::SetFfMacSchedSapUser (FfMacSchedSapUser *s)
+{
+  m_user = s;
+}
+
+FfMacCschedSapProvider *
+NbIotFfMacScheduler::GetFfMacCschedSapProvider ()
+{
+  return m_cschedProvider;
+}
+
+FfMacSchedSapProvider *
+NbIotFfMacScheduler::GetFfMacSchedSapProvider ()
+{
+  return m_schedProvider;
+}
+
+void
+NbIotFfMacScheduler::SetLteFfrSapProvider (LteFfrSapProvider *s)
+{
+  m_inner->SetLteFfrSapProvider (s);
+}
+
+LteFfrSapUser *
+NbIotFfMacScheduler::GetLteFfrSapUser ()
+{
+  return m_inner->GetLteFfrSapUser ();
+}
+
+void
+NbIotFfMacScheduler::SetCeLevel (uint16_t rnti, uint8_t ceLevel)
+{
+  std::unordered_map<uint16_t, Ue>::iterator it = m_ues.find (rnti);
+  if (it != m_ues.end ())
+    {
+      it->second.ceLevel = std::min<uint8_t> (ceLevel, 2);
+    }
+}
+
+uint32_t
+NbIotFfMacScheduler::GetWaitingUes () const
+{
+  return m_waiting.size ();
+}
+
+void
+NbIotFfMacScheduler::ParseLevels (std::string values, const char *name, uint32_t levels[3])
+{
+  std::replace (values.begin (), values.end (), ':', ' ');
+  std::istringstream fields (values);
+  fields >> levels[0] >> levels[1] >> levels[2];
+  NS_ABORT_MSG_IF (fields.fail (), "NbIotFfMacScheduler::" << name << " needs three values");
+}
+
+void
+NbIotFfMacScheduler::CellConfig (uint8_t ulBandwidth)
+{
+  // Attributes are final by the cell configuration
+  uint32_t tones[3];
+  uint32_t repetitions[3];
+  ParseLevels (m_tones, "Tones", tones);
+  ParseLevels (m_repetitions, "Repetitions", repetitions);
+  ParseLevels (m_itbs, "Itbs", m_itbsOf);
+  ParseLevels (m_mcs, "Mcs", m_mcsOf);
+  for (uint32_t level = 0; level < 3; ++level)
+    {
+      NS_ABORT_MSG_UNLESS (tones[level] == 12 || tones[level] == 6 || tones[level] == 3 || tones[level] == 1,
+                           "NPUSCH RUs have 12, 6, 3 or 1 tones, not " << tones[level]);
+      NS_ABORT_MSG_UNLESS (m_itbsOf[level] <= 12, "NPUSCH I_TBS goes up to 12");
+      NS_ABORT_MSG_UNLESS (m_mcsOf[level] <= 28 && repetitions[level] > 0, "Bad MCS or repetitions of CE level " << level);
+      m_ruSubframes[level] = (tones[level] == 1 ? 8 : 12 / tones[level]) * repetitions[level];
+    }
+
+  m_ulBandwidth = ulBandwidth;
+  Transmission none = {0, 0, 0, 0, 0, false};
+  m_running.assign (m_ulBandwidth, none);
+}
+
+void
+NbIotFfMacScheduler::UeConfig (uint16_t rnti)
+{
+  Ue ue = {0, 0, 0, false, 0, 0, 0, 0};
+  m_ues.insert (std::make_pair (rnti, ue));
+}
+
+void
+NbIotFfMacScheduler::UeRelease (uint16_t rnti)
+{
+  // A waiting entry is dropped when it reaches the head of the queue
+  m_ues.erase (rnti);
+  for (uint32_t rb = 0; rb < m_running.size (); ++rb)
+    {
+      if (m_running[rb].rnti == rnti)
+        {
+          m_running[rb].rnti = 0;
+        }
+    }
+}
+
+void
+NbIotFfMacScheduler::MacCtrlInfo (const FfMacSchedSapProvider::SchedUlMacCtrlInfoReqParameters &params)
+{
+  for (uint32_t i = 0; i < params.m_macCeList.size (); ++i)
+    {
+      const MacCeListElement_s &ce = params.m_macCeList[i];
+      std::unordered_map<uint16_t, Ue>::iterator it = m_ues.find (ce.m_rnti);
+      if (ce.m_macCeType != MacCeListElement_s::BSR || it == m_ues.end ())
+        {
+          continue;
+        }
+      uint32_t buffer = 0;
+      for (uint32_t lcg = 0; lcg < ce.m_macCeValue.m_bufferStatus.size (); ++lcg)
+        {
+          buffer += BufferSizeLevelBsr::BsrId2BufferSize (ce.m_macCeValue.m_bufferStatus[lcg]);
+        }
+      // The UE still counts what it has been granted but not sent yet
+      Ue &ue = it->second;
+      ue.buffer = buffer > ue.inFlight ? buffer - ue.inFlight : 0;
+      if (ue.buffer > 0 && !ue.busy)
+        {
+          ue.busy = true;
+          m_waiting.push_back (ce.m_rnti);
+        }
+    }
+}
+
+void
+NbIotFfMacScheduler::ReserveRar (const FfMacSchedSapUser::SchedDlConfigIndParameters &params)
+{
+  for (uint32_t i = 0; i < params.m_buildRarList.size (); ++i)
+    {
+      const UlGrant_s &grant = params.m_buildRarList[i].m_grant;
+      m_rarGrants.push_back (std::make_pair (grant.m_rbStart, grant.m_rbLen));
+    }
+}
+
+UlDciListElement_s
+NbIotFfMacScheduler::MakeDci (uint16_t rnti, uint8_t rb, uint16_t tbSize, uint8_t mcs, uint8_t ndi)
+{
+  UlDciListElement_s dci;
+  dci.m_rnti = rnti;
+  dci.m_rbStart = rb;
+  dci.m_rbLen = 1;
+  dci.m_tbSize = tbSize;
+  dci.m_mcs = mcs;
+  dci.m_ndi = ndi;
+  dci.m_cceIndex = 0;
+  dci.m_aggrLevel = 1;
+  dci.m_ueTxAntennaSelection = 3;
+  dci.m_hopping = false;
+  dci.m_n2Dmrs = 0;
+  dci.m_tpc = 0;
+  dci.m_cqiRequest = false;
+  dci.m_ulIndex = 0;
+  dci.m_dai = 1;
+  dci.m_freqHopping = 0;
+  dci.m_pdcchPowerOffset = 0;
+  return dci;
+}
+
+void
+NbIotFfMacScheduler::UlTrigger (const FfMacSchedSapProvider::SchedUlTriggerReqParameters &params)
+{
+  // RBs of the Msg3 grants are left alone this subframe; a transmission
+  // running there is held for one subframe
+  std::vector<bool> reserved (m_running.size (), false);
+  for (uint32_t i = 0; i < m_rarGrants.size (); ++i)
+    {
+      for (uint32_t rb = m_rarGrants[i].first; rb < m_rarGrants[i].first + m_rarGrants[i].second && rb < reserved.size (); ++rb)
+        {
+          reserved[rb] = true;
+        }
+    }
+  m_rarGrants.clear ();
+
+  // Retransmissions first, on the free RBs; a block that finds none, or has
+  // had all its retransmissions, is lost
+  FfMacSchedSapUser::SchedUlConfigIndParameters ret;
+  std::vector<uint16_t> retransmitting;
+  for (uint32_t i = 0; i < params.m_ulInfoList.size (); ++i)
+    {
+      const UlInfoListElement_s &info = params.m_ulInfoList[i];
+      std::unordered_map<uint16_t, Ue>::iterator it = m_ues.find (info.m_rnti);
+      if (info.m_receptionStatus != UlInfoListElement_s::NotOk || it == m_ues.end ())
+        {
+          continue;
+        }
+      Ue &ue = it->second;
+      uint32_t rb = 0;
+      while (rb < m_running.size () && (reserved[rb] || m_running[rb].rnti != 0))
+        {
+          ++rb;
+        }
+      if (ue.lastTbSize == 0 || ue.retx >= g_maxUlRetx || rb == m_running.size ())
+        {
+          continue;
+        }
+      ++ue.retx;
+      retransmitting.push_back (info.m_rnti);
+      ret.m_dciList.push_back (MakeDci (info.m_rnti, rb, ue.lastTbSize, ue.lastMcs, 0));
+      Transmission retx = {info.m_rnti, ue.lastTbSize, ue.lastMcs, ue.lastSubframes, ue.lastSubframes, true};
+      m_running[rb] = retx;
+    }
+
+  for (uint32_t rb = 0; rb < m_running.size (); ++rb)
+    {
+      if (reserved[rb])
+        {
+          continue;
+        }
+      Transmission &tx = m_running[rb];
+      while (tx.rnti == 0 && !m_waiting.empty ())
+        {
+          uint16_t rnti = m_waiting.front ();
+          m_waiting.pop_front ();
+          std::unordered_map<uint16_t, Ue>::iterator it = m_ues.find (rnti);
+          if (it == m_ues.end () || it->second.inFlight > 0)
+            {
+              continue;
+            }
+          Ue &ue = it->second;
+          if (ue.buffer == 0)
+            {
+              ue.busy = false;
+              continue;
+            }
+          // Fewest RUs that carry the buffer, else the largest block
+          const uint16_t *tbs = g_npuschTbs[m_itbsOf[ue.ceLevel]];
+          uint32_t iru = 0;
+          while (iru < 7 && tbs[iru] < ue.buffer * 8)
+            {
+              ++iru;
+            }
+          tx.rnti = rnti;
+          tx.tbSize = tbs[iru] / 8;
+          tx.mcs = m_mcsOf[ue.ceLevel];
+          tx.subframes = g_npuschRus[iru] * m_ruSubframes[ue.ceLevel];
+          tx.remaining = tx.subframes;
+          tx.sent = false;
+          ue.inFlight = tx.tbSize;
+          ue.buffer -= std::min<uint32_t> (ue.buffer, tx.tbSize);
+        }
+      if (tx.rnti == 0 || --tx.remaining > 0)
+        {
+          continue;
+        }
+      if (tx.sent)
+        {
+          tx.rnti = 0;
+          continue;
+        }
+      // One UL DCI per UE and subframe: a new block waits for the retransmission
+      if (std::find (retransmitting.begin (), retransmitting.end (), tx.rnti) != retransmitting.end ())
+        {
+          tx.remaining = 1;
+          continue;
+        }
+
+      // Last subframe of the RUs and repetitions: the block goes out now
+      ret.m_dciList.push_back (MakeDci (tx.rnti, rb, tx.tbSize, tx.mcs, 1));
+      Ue &ue = m_ues[tx.rnti];
+      ue.lastTbSize = tx.tbSize;
+      ue.lastMcs = tx.mcs;
+      ue.lastSubframes = tx.subframes;
+      ue.retx = 0;
+      ue.inFlight = 0;
+      if (ue.buffer > 0)
+        {
+          m_waiting.push_back (tx.rnti);
+        }
+      else
+        {
+          ue.busy = false;
+        }
+      tx.rnti = 0;
+    }
+  m_user->SchedUlConfigInd (ret);
+}
+
+} // namespace ns3
@@ -0,0 +1,108 @@
+#ifndef NBIOT_FF_MAC_SCHEDULER_H
+#define NBIOT_FF_MAC_SCHEDULER_H
+
+#include "ns3/ff-mac-scheduler.h"
+#include "ns3/ff-mac-csched-sap.h"
+#include "ns3/ff-mac-sched-sap.h"
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ns3 {
+
+/* NB-IoT style scheduler. Downlink, random access and bearer configuration
+ * are left to an inner RrFfMacScheduler; the uplink is allocated in NPUSCH
+ * resource units (RUs) of 12, 6, 3 or 1 tones (1, 2, 4 or 8 ms at 15 kHz),
+ * with the repetition factor of the UE's CE level. An RU is about one
+ * RB-subframe of resources whatever its tones, so a transmission holds one
+ * RB for N_RU x RU length x repetitions subframes and gets its whole
+ * transport block (36.213 NPUSCH TBS table) in the DCI of its last subframe:
+ * capacity and latency follow NB-IoT, the link sees one 1-RB TTI at the CE
+ * level's MCS. Only UEs with a pending BSR are visited: a FIFO of waiting
+ * UEs plus at most one running transmission per RB. A NACKed block is
+ * granted again (up to 3 times) in the subframe its NACK arrives, as the LTE
+ * UE MAC retransmits from the HARQ buffer of that subframe, on a free RB that
+ * is then held as long as the block's RUs and repetitions.
+ */
+class NbIotFfMacScheduler : public FfMacScheduler
+{
+public:
+  static TypeId GetTypeId (void);
+  NbIotFfMacScheduler ();
+  virtual ~NbIotFfMacScheduler ();
+  virtual void DoDispose (void);
+
+  virtual void SetFfMacCschedSapUser (FfMacCschedSapUser *s);
+  virtual void SetFfMacSchedSapUser (FfMacSchedSapUser *s);
+  virtual FfMacCschedSapProvider *GetFfMacCschedSapProvider ();
+  virtual FfMacSchedSapProvider *GetFfMacSchedSapProvider ();
+  virtual void SetLteFfrSapProvider (LteFfrSapProvider *s);
+  virtual LteFfrSapUser *GetLteFfrSapUser ();
+
+  void SetCeLevel (uint16_t rnti, uint8_t ceLevel);
+  uint32_t GetWaitingUes () const;
+
+private:
+  class CschedProvider;
+  class SchedProvider;
+  class SchedUser;
+  friend class CschedProvider;
+  friend class SchedProvider;
+  friend class SchedUser;
+
+  struct Ue
+  {
+    uint32_t buffer;       // [B], from the last BSR minus what was granted since
+    uint32_t inFlight;     // [B], granted to the running transmission
+    uint8_t ceLevel;
+    bool busy;             // waiting or transmitting
+    uint16_t lastTbSize;   // [B], last block sent, kept for its retransmissions
+    uint8_t lastMcs;
+    uint32_t lastSubframes;
+    uint8_t retx;          // retransmissions of the last block so far
+  };
+  struct Transmission
+  {
+    uint16_t rnti;
+    uint16_t tbSize;       // [B]
+    uint8_t mcs;
+    uint32_t subframes;    // RUs x RU length x repetitions
+    uint32_t remaining;    // subframes including the current one
+    bool sent;             // a retransmission, whose DCI went out at its start
+  };
+
+  void UeConfig (uint16_t rnti);
+  void UeRelease (uint16_t rnti);
+  void MacCtrlInfo (const FfMacSchedSapProvider::SchedUlMacCtrlInfoReqParameters &params);
+  void UlTrigger (const FfMacSchedSapProvider::SchedUlTriggerReqParameters &params);
+  void ReserveRar (const FfMacSchedSapUser::SchedDlConfigIndParameters &params);
+  void CellConfig (uint8_t ulBandwidth);
+  static UlDciListElement_s MakeDci (uint16_t rnti, uint8_t rb, uint16_t tbSize, uint8_t mcs, uint8_t ndi);
+  static void ParseLevels (std::string values, const char *name, uint32_t levels[3]);
+
+  Ptr<FfMacScheduler> m_inner;
+  FfMacCschedSapProvider *m_innerCsched;
+  FfMacSchedSapProvider *m_innerSched;
+  FfMacCschedSapProvider *m_cschedProvider;
+  FfMacSchedSapProvider *m_schedProvider;
+  SchedUser *m_schedUser;
+  FfMacSchedSapUser *m_user;
+  std::string m_tones;
+  std::string m_repetitions;
+  std::string m_itbs;
+  std::string m_mcs;
+  uint32_t m_ruSubframes[3];    // per CE level: RU length x repetitions
+  uint32_t m_itbsOf[3];
+  uint32_t m_mcsOf[3];
+  uint8_t m_ulBandwidth;
+  std::unordered_map<uint16_t, Ue> m_ues;
+  std::deque<uint16_t> m_waiting;
+  std::vector<Transmission> m_running;    // indexed by RB, rnti 0 = free
+  std::vector<std::pair<uint8_t, uint8_t> > m_rarGrants;   // RB start, length
+};
+
+} // namespace ns3
+
+#endif /* NBIOT_FF_MAC_SCHEDULER_H */
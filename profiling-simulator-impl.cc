@@ -0,0 +1,203 @@
+#include "profiling-simulator-impl.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <fstream>
+#include <map>
+#include <typeinfo>
+
+namespace ns3 {
+
+/* Runs the wrapped event and reports its execution time */
+class ProfilingSimulatorImpl::ProfiledEvent : public EventImpl
+{
+public:
+  ProfiledEvent (ProfilingSimulatorImpl *simulator, const Key &key, EventImpl *event)
+    : m_simulator (simulator),
+      m_key (key),
+      m_event (event)
+  {
+  }
+  virtual ~ProfiledEvent ()
+  {
+    m_event->Unref ();
+  }
+
+private:
+  virtual void Notify (void)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+    m_event->Invoke ();
+    m_simulator->Executed (m_key, std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ());
+  }
+
+  ProfilingSimulatorImpl *m_simulator;
+  Key m_key;
+  EventImpl *m_event;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (ProfilingSimulatorImpl);
+
+std::string ProfilingSimulatorImpl::s_reportName = "EventProfile";
+
+TypeId
+ProfilingSimulatorImpl::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::ProfilingSimulatorImpl")
+    .SetParent<DefaultSimulatorImpl> ()
+    .AddConstructor<ProfilingSimulatorImpl> ()
+    .AddAttribute ("DepthInterval", "Simulated time between two queue depth samples",
+                   TimeValue (MilliSeconds (100)),
+                   MakeTimeAccessor (&ProfilingSimulatorImpl::m_depthInterval),
+                   MakeTimeChecker ())
+  ;
+  return tid;
+}
+
+void
+ProfilingSimulatorImpl::SetReportName (std::string name)
+{
+  s_reportName = name;
+}
+
+ProfilingSimulatorImpl::ProfilingSimulatorImpl ()
+  : m_depthInterval (MilliSeconds (100)),
+    m_nextDepthSample (Seconds (0)),
+    m_pending (0)
+{
+}
+
+EventImpl *
+ProfilingSimulatorImpl::Wrap (uint32_t context, EventImpl *event)
+{
+  // typeid names are unique static strings, demangled only for the report
+  Key key (typeid (*event).name (), context);
+  ++m_stats[key].scheduled;
+  ++m_pending;
+  return new ProfiledEvent (this, key, event);
+}
+
+EventId
+ProfilingSimulatorImpl::Schedule (Time const &delay, EventImpl *event)
+{
+  return DefaultSimulatorImpl::Schedule (delay, Wrap (GetContext (), event));
+}
+
+void
+ProfilingSimulatorImpl::ScheduleWithContext (uint32_t context, Time const &delay, EventImpl *event)
+{
+  DefaultSimulatorImpl::ScheduleWithContext (context, delay, Wrap (context, event));
+}
+
+EventId
+ProfilingSimulatorImpl::ScheduleNow (EventImpl *event)
+{
+  return DefaultSimulatorImpl::ScheduleNow (Wrap (GetContext (), event));
+}
+
+void
+ProfilingSimulatorImpl::Remove (const EventId &id)
+{
+  if (!id.IsExpired ())
+    {
+      --m_pending;
+    }
+  DefaultSimulatorImpl::Remove (id);
+}
+
+void
+ProfilingSimulatorImpl::Cancel (const EventId &id)
+{
+  if (!id.IsExpired ())
+    {
+      --m_pending;
+    }
+  DefaultSimulatorImpl::Cancel (id);
+}
+
+void
+ProfilingSimulatorImpl::Executed (const Key &key, double seconds)
+{
+  Stats &stats = m_stats[key];
+  ++stats.executed;
+  stats.seconds += seconds;
+  --m_pending;
+  if (Now () >= m_nextDepthSample)
+    {
+      m_depth.push_back (std::make_pair (Now ().GetSeconds (), m_pending));
+      m_nextDepthSample = Now () + m_depthInterval;
+    }
+}
+
+/* "void (ns3::LteEnbPhy::*)()" out of the MakeEvent<...>::EventMemberImpl type */
+static std::string
+CallbackTypeName (const char *mangled)
+{
+  int status;
+  char *demangled = abi::__cxa_demangle (mangled, 0, 0, &status);
+  std::string name = status == 0 ? demangled : mangled;
+  std::free (demangled);
+  size_t start = name.find ("MakeEvent<");
+  if (start == std::string::npos)
+    {
+      return name;
+    }
+  start += 10;
+  int depth = 0;
+  for (size_t i = start; i < name.size (); ++i)
+    {
+      if (name[i] == '<' || name[i] == '(')
+        ++depth;
+      else if ((name[i] == '>' || name[i] == ')') && depth > 0)
+        --depth;
+      else if ((name[i] == ',' || name[i] == '>') && depth == 0)
+        return name.substr (start, i - start);
+    }
+  return name;
+}
+
+void
+ProfilingSimulatorImpl::Destroy ()
+{
+  double simSeconds = std::max (Now ().GetSeconds (), 1e-9);
+  DefaultSimulatorImpl::Destroy ();
+  uint64_t executed = 0;
+  for (std::unordered_map<Key, Stats, KeyHash>::const_iterator it = m_stats.begin (); it != m_stats.end (); ++it)
+    {
+      executed += it->second.executed;
+    }
+  if (s_reportName.empty () || executed == 0)
+    {
+      return;
+    }
+
+  std::vector<std::pair<Key, Stats> > rows (m_stats.begin (), m_stats.end ());
+  std::sort (rows.begin (), rows.end (), [] (const std::pair<Key, Stats> &a, const std::pair<Key, Stats> &b)
+             { return a.second.seconds > b.second.seconds; });
+  std::map<const char *, std::string> names;
+  std::ofstream out ((s_reportName + ".csv").c_str ());
+  out << "callback,node,scheduled,executed,totalSeconds,meanNs,msPerSimSecond\n";
+  for (uint32_t i = 0; i < rows.size (); ++i)
+    {
+      const Key &key = rows[i].first;
+      const Stats &stats = rows[i].second;
+      std::string &name = names[key.first];
+      if (name.empty ())
+        {
+          name = CallbackTypeName (key.first);
+        }
+      out << '"' << name << "\"," << (key.second == 0xffffffff ? -1 : int64_t (key.second)) << ','
+          << stats.scheduled << ',' << stats.executed << ',' << stats.seconds << ','
+          << (stats.executed > 0 ? stats.seconds / stats.executed * 1e9 : 0) << ','
+          << stats.seconds / simSeconds * 1e3 << '\n';
+    }
+  std::ofstream depth ((s_reportName + "Depth.csv").c_str ());
+  depth << "time,pending\n";
+  for (uint32_t i = 0; i < m_depth.size (); ++i)
+    {
+      depth << m_depth[i].first << ',' << m_depth[i].second << '\n';
+    }
+}
+
+} // namespace ns3
@@ -0,0 +1,69 @@
+#ifndef PROFILING_SIMULATOR_IMPL_H
+#define PROFILING_SIMULATOR_IMPL_H
+
+#include "ns3/default-simulator-impl.h"
+#include "ns3/event-impl.h"
+#include "ns3/nstime.h"
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ns3 {
+
+/* Event profiler, selected as SimulatorImplementationType. Every scheduled
+ * event is wrapped so that its execution is timed and attributed to the
+ * event's callback type (the bound member function's class, i.e. the
+ * layer) and the node it runs on. At Destroy two CSV files are written:
+ * <name>.csv, one row per (callback, node) sorted by cumulative time, with
+ * the cost per simulated second; and <name>Depth.csv, the number of pending
+ * events sampled every 'DepthInterval'. Events cancelled through their
+ * EventId stay counted as pending until the end, so the depth is an upper
+ * bound. Nothing is written without a report name or executed events, as
+ * in the parents of forked runs.
+ */
+class ProfilingSimulatorImpl : public DefaultSimulatorImpl
+{
+public:
+  static TypeId GetTypeId (void);
+  static void SetReportName (std::string name);
+  ProfilingSimulatorImpl ();
+
+  virtual EventId Schedule (Time const &delay, EventImpl *event);
+  virtual void ScheduleWithContext (uint32_t context, Time const &delay, EventImpl *event);
+  virtual EventId ScheduleNow (EventImpl *event);
+  virtual void Remove (const EventId &id);
+  virtual void Cancel (const EventId &id);
+  virtual void Destroy ();
+
+private:
+  struct Stats
+  {
+    uint64_t scheduled;
+    uint64_t executed;
+    double seconds;
+  };
+  typedef std::pair<const char *, uint32_t> Key;   // callback type name, node
+  struct KeyHash
+  {
+    size_t operator() (const Key &key) const
+    {
+      return std::hash<const char *> () (key.first) * 31 + key.second;
+    }
+  };
+  class ProfiledEvent;
+
+  EventImpl *Wrap (uint32_t context, EventImpl *event);
+  void Executed (const Key &key, double seconds);
+
+  static std::string s_reportName;
+  Time m_depthInterval;
+  Time m_nextDepthSample;
+  int64_t m_pending;
+  std::unordered_map<Key, Stats, KeyHash> m_stats;
+  std::vector<std::pair<double, int64_t> > m_depth;
+};
+
+} // namespace ns3
+
+#endif /* PROFILING_SIMULATOR_IMPL_H */